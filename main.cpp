@@ -8,6 +8,33 @@
 #include <queue>
 #include <chrono>
 #include <functional>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cmath>
+#include <csignal>
+#include <cerrno>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/file.h>
 
 using namespace std;
 
@@ -33,6 +60,72 @@ struct RequiredLiteralNodeException : public exception {
     }
 };
 
+struct EmptyScoringException : public exception {
+    virtual const char* what() const throw() {
+        return "scoring needs at least one tier";
+    }
+};
+
+struct TooManyNumbersException : public exception {
+    virtual const char* what() const throw() {
+        return "too many numbers for packed expression";
+    }
+};
+
+struct NoSuchNumberException : public exception {
+    virtual const char* what() const throw() {
+        return "no number at that position";
+    }
+};
+
+struct ProtocolException : public exception {
+    virtual const char* what() const throw() {
+        return "malformed binary message";
+    }
+};
+
+struct SharedMemoryException : public exception {
+    virtual const char* what() const throw() {
+        return "cannot map shared memory segment";
+    }
+};
+
+struct BudgetExceededException : public exception {
+    virtual const char* what() const throw() {
+        return "cpu time or memory limit exceeded";
+    }
+};
+
+struct DeadlineExceededException : public exception {
+    virtual const char* what() const throw() {
+        return "deadline exceeded";
+    }
+};
+
+struct SnapshotException : public exception {
+    virtual const char* what() const throw() {
+        return "cannot read or write table snapshot";
+    }
+};
+
+struct StoreException : public exception {
+    virtual const char* what() const throw() {
+        return "cannot open result store";
+    }
+};
+
+struct DatabaseException : public exception {
+    virtual const char* what() const throw() {
+        return "cannot read or write database file";
+    }
+};
+
+struct GeneratorException : public exception {
+    virtual const char* what() const throw() {
+        return "no puzzles meet the constraints";
+    }
+};
+
 /********************************************************************
 EXPRESSION TREES
 ********************************************************************/
@@ -354,6 +447,76 @@ bool better(const Best &lhs, const Best &rhs, int target) {
     return abs(lhs.value - target) < abs(rhs.value - target);
 }
 
+// Scores a result by its distance from the target in tiers, nearest first:
+// Countdown gives 10 points when exact, 7 within 5 and 5 within 10. The
+// searches stop as soon as they hold a result in the top tier, a window
+// around the target that is just the target itself by default.
+struct Scoring {
+    vector<pair<double, int>> tiers; // greatest distance and points
+
+    explicit Scoring(double tolerance = 0., int points = 1) : tiers({{tolerance, points}}) {}
+    Scoring(vector<pair<double, int>> tiers) : tiers(tiers) {
+        if (tiers.empty()) throw EmptyScoringException();
+    }
+
+    int score(double value, double target) const {
+        for (const pair<double, int> &tier : tiers) {
+            if (abs(value - target) <= tier.first) return tier.second;
+        }
+        return 0;
+    }
+
+    double tolerance() const {
+        return tiers.front().first;
+    }
+
+    // nothing can score more
+    bool done(double value, double target) const {
+        return abs(value - target) <= tolerance();
+    }
+};
+
+const Scoring COUNTDOWN_SCORING({{0., 10}, {5., 7}, {10., 5}});
+
+// Visits the memoized values an open node could take for an expression to
+// land within tolerance of the target, until check accepts one. The value
+// of an expression with one open node is a linear fractional function of
+// it, so the values making it land in the window are those between the
+// values required at either edge; or, when the window holds the value at
+// infinity and the value required at the target falls outside them, all
+// the others. When both edges require the same value the expression does
+// not depend on the open node, as 0 / x, and any value may do. Candidates
+// still need checking, since the required values are rounded. Without
+// required values everything is visited.
+template <typename Value, typename Required, typename Check>
+bool scan_window(const map<double, Value> &values, double target, double tolerance, Required required, Check check) {
+    double lo = -INFINITY, hi = INFINITY;
+    bool wrapped = false;
+    try {
+        double low = required(target - tolerance), high = required(target + tolerance), middle = required(target);
+        if (!isnan(low) && !isnan(high) && !isnan(middle) && (tolerance == 0. || low != high)) {
+            lo = min(low, high);
+            hi = max(low, high);
+            wrapped = middle < lo || middle > hi;
+        }
+    } catch (DivisionByZeroException &e) {
+    } catch (RequiredLiteralNodeException &e) {}
+
+    if (!wrapped) {
+        for (auto it = values.lower_bound(lo); it != values.end() && it->first <= hi; ++it) {
+            if (check(it->second)) return true;
+        }
+        return false;
+    }
+    for (auto it = values.begin(); it != values.end() && it->first <= lo; ++it) {
+        if (check(it->second)) return true;
+    }
+    for (auto it = values.lower_bound(hi); it != values.end(); ++it) {
+        if (check(it->second)) return true;
+    }
+    return false;
+}
+
 ostream& operator<<(ostream& os, const Best &best) {
     os << best.expr->to_string() << " = " << best.expr->evaluate();
     // os << target << " - " << best.expr->evaluate() << " = " << target-best.expr->evaluate() << endl;
@@ -365,7 +528,7 @@ ostream& operator<<(ostream& os, const Best &best) {
 DEPTH FIRST SEARCH
 ********************************************************************/
 
-Best dfs(shared_ptr<Expr> expr, double target, set<double> numbers, Best best, long long &explored) {
+Best dfs(shared_ptr<Expr> expr, double target, set<double> numbers, Best best, long long &explored, const Scoring &scoring = Scoring()) {
     explored++;
 
     if (numbers.empty() && expr->evaluable()) {
@@ -377,26 +540,26 @@ Best dfs(shared_ptr<Expr> expr, double target, set<double> numbers, Best best, l
         for (double number : numbers) {
             set<double> next_numbers(numbers);
             next_numbers.erase(number);
-            Best opt = dfs(clone_and_fill(expr, make_shared<Lit>(number)), target, next_numbers, best, explored);
+            Best opt = dfs(clone_and_fill(expr, make_shared<Lit>(number)), target, next_numbers, best, explored, scoring);
             if (better(opt, best, target)) best = opt;
 
             // lucky stop
-            if (best.value == target) return best;
+            if (scoring.done(best.value, target)) return best;
         }
 
         if (expr->size() < numbers.size()) { // avoid infinite recursion
-            Best add = dfs(clone_and_fill(expr, make_shared<Op<Add>>()), target, numbers, best, explored);
+            Best add = dfs(clone_and_fill(expr, make_shared<Op<Add>>()), target, numbers, best, explored, scoring);
             if (better(add, best, target)) best = add;
-            if (best.value == target) return best;
-            Best sub = dfs(clone_and_fill(expr, make_shared<Op<Sub>>()), target, numbers, best, explored);
+            if (scoring.done(best.value, target)) return best;
+            Best sub = dfs(clone_and_fill(expr, make_shared<Op<Sub>>()), target, numbers, best, explored, scoring);
             if (better(sub, best, target)) best = sub;
-            if (best.value == target) return best;
-            Best mul = dfs(clone_and_fill(expr, make_shared<Op<Mul>>()), target, numbers, best, explored);
+            if (scoring.done(best.value, target)) return best;
+            Best mul = dfs(clone_and_fill(expr, make_shared<Op<Mul>>()), target, numbers, best, explored, scoring);
             if (better(mul, best, target)) best = mul;
-            if (best.value == target) return best;
-            Best div = dfs(clone_and_fill(expr, make_shared<Op<Div>>()), target, numbers, best, explored);
+            if (scoring.done(best.value, target)) return best;
+            Best div = dfs(clone_and_fill(expr, make_shared<Op<Div>>()), target, numbers, best, explored, scoring);
             if (better(div, best, target)) best = div;
-            if (best.value == target) return best;
+            if (scoring.done(best.value, target)) return best;
         }
     }
 
@@ -408,7 +571,22 @@ Best dfs(shared_ptr<Expr> expr, double target, set<double> numbers, Best best, l
 DEPTH FIRST SEARCH WITH MEMOIZATION
 ********************************************************************/
 
-Best dfs_mem(shared_ptr<Expr> expr, double target, set<double> numbers, Best best, long long &explored, map<set<double>, map<double, shared_ptr<Expr>>> &mem) {
+// a memoized subtree for the one open node of expr that brings it into the
+// top tier
+shared_ptr<Expr> fill_window(shared_ptr<Expr> expr, double target, const map<double, shared_ptr<Expr>> &values, const Scoring &scoring) {
+    shared_ptr<Expr> answer;
+    scan_window(values, target, scoring.tolerance(), [&](double value) { return expr->required(value); }, [&](shared_ptr<Expr> sub) {
+        try {
+            answer = clone_and_fill(expr, sub);
+            if (scoring.done(answer->evaluate(), target)) return true;
+        } catch (DivisionByZeroException &e) {}
+        answer = nullptr;
+        return false;
+    });
+    return answer;
+}
+
+Best dfs_mem(shared_ptr<Expr> expr, double target, set<double> numbers, Best best, long long &explored, map<set<double>, map<double, shared_ptr<Expr>>> &mem, const Scoring &scoring = Scoring()) {
     explored++;
 
     if (numbers.empty() && expr->evaluable()) {
@@ -426,38 +604,34 @@ Best dfs_mem(shared_ptr<Expr> expr, double target, set<double> numbers, Best bes
         // first see if we encountered the missing subtree before
         if (expr->size() == 1) {
             try {
-                double required = expr->required(target);
-                auto it = mem[numbers].find(required);
-                if (it != mem[numbers].end()) {
-                    shared_ptr<Expr> answer = clone_and_fill(expr, it->second);
-                    return Best(answer);
-                }
+                shared_ptr<Expr> answer = fill_window(expr, target, mem[numbers], scoring);
+                if (answer) return Best(answer);
             } catch (DivisionByZeroException &e) {}
         }
 
         for (double number : numbers) {
             set<double> next_numbers(numbers);
             next_numbers.erase(number);
-            Best opt = dfs_mem(clone_and_fill(expr, make_shared<Lit>(number)), target, next_numbers, best, explored, mem);
+            Best opt = dfs_mem(clone_and_fill(expr, make_shared<Lit>(number)), target, next_numbers, best, explored, mem, scoring);
             if (better(opt, best, target)) best = opt;
 
             // lucky stop
-            if (best.value == target) return best;
+            if (scoring.done(best.value, target)) return best;
         }
 
         if (expr->size() < numbers.size()) { // avoid infinite recursion
-            Best add = dfs_mem(clone_and_fill(expr, make_shared<Op<Add>>()), target, numbers, best, explored, mem);
+            Best add = dfs_mem(clone_and_fill(expr, make_shared<Op<Add>>()), target, numbers, best, explored, mem, scoring);
             if (better(add, best, target)) best = add;
-            if (best.value == target) return best;
-            Best sub = dfs_mem(clone_and_fill(expr, make_shared<Op<Sub>>()), target, numbers, best, explored, mem);
+            if (scoring.done(best.value, target)) return best;
+            Best sub = dfs_mem(clone_and_fill(expr, make_shared<Op<Sub>>()), target, numbers, best, explored, mem, scoring);
             if (better(sub, best, target)) best = sub;
-            if (best.value == target) return best;
-            Best mul = dfs_mem(clone_and_fill(expr, make_shared<Op<Mul>>()), target, numbers, best, explored, mem);
+            if (scoring.done(best.value, target)) return best;
+            Best mul = dfs_mem(clone_and_fill(expr, make_shared<Op<Mul>>()), target, numbers, best, explored, mem, scoring);
             if (better(mul, best, target)) best = mul;
-            if (best.value == target) return best;
-            Best div = dfs_mem(clone_and_fill(expr, make_shared<Op<Div>>()), target, numbers, best, explored, mem);
+            if (scoring.done(best.value, target)) return best;
+            Best div = dfs_mem(clone_and_fill(expr, make_shared<Op<Div>>()), target, numbers, best, explored, mem, scoring);
             if (better(div, best, target)) best = div;
-            if (best.value == target) return best;
+            if (scoring.done(best.value, target)) return best;
         }
     }
 
@@ -512,7 +686,7 @@ Best emplace(shared_ptr<Expr> expr, double target, set<double> numbers, priority
     return Best();
 }
 
-Best astar(int target, set<double> numbers, long long &explored, bool use_mem, bool use_uniq_queue, function<double(shared_ptr<Expr>)> heuristic) {
+Best astar(int target, set<double> numbers, long long &explored, bool use_mem, bool use_uniq_queue, function<double(shared_ptr<Expr>)> heuristic, const Scoring &scoring = Scoring()) {
     Best best;
 
     priority_queue<Node> q;
@@ -522,16 +696,14 @@ Best astar(int target, set<double> numbers, long long &explored, bool use_mem, b
 
     map<set<double>, map<double, shared_ptr<Expr>>> mem;
 
-    while (!q.empty() && best.value != target) {
+    while (!q.empty() && !scoring.done(best.value, target)) {
         Node cur = q.top();
         q.pop();
 
         if (use_mem && cur.expr->size() == 1) {
             try {
-                double required = cur.expr->required(target);
-                auto it = mem[cur.numbers].find(required);
-                if (it != mem[cur.numbers].end()) {
-                    shared_ptr<Expr> answer = clone_and_fill(cur.expr, it->second);
+                shared_ptr<Expr> answer = fill_window(cur.expr, target, mem[cur.numbers], scoring);
+                if (answer) {
                     best = Best(answer);
                     return best;
                 }
@@ -567,95 +739,4663 @@ Best astar(int target, set<double> numbers, long long &explored, bool use_mem, b
 }
 
 /********************************************************************
-MAIN
+PACKED EXPRESSIONS
 ********************************************************************/
 
-#define MS 1000
-#define US 1000000
-#define NS 1000000000
+// For up to 8 numbers a (partial) expression fits in one machine word. The
+// filled nodes are stored in prefix order as 4 bit codes, starting at the
+// least significant nibble: codes 0-7 refer to a number by its index, codes
+// 8-11 are the operators. The top nibble holds the number of filled nodes.
+// Open nodes are not stored, because we always fill the left most open node
+// they are exactly the positions after the filled ones.
+typedef uint64_t Packed;
+
+#define PACKED_NUMBERS 8
+#define PACKED_ADD 8
+#define PACKED_SUB 9
+#define PACKED_MUL 10
+#define PACKED_DIV 11
+
+// a single open node
+const Packed PACKED_OPEN = 0;
+
+inline int packed_length(Packed expr) {
+    return (int)(expr >> 60);
+}
 
-struct Metrics {
-    Best best;
-    long long explored;
-    long long s, ms, us, ns;
+inline int packed_code(Packed expr, int i) {
+    return (int)((expr >> (4 * i)) & 0xF);
+}
 
-    Metrics(Best best, long long explored, long long time) : best(best), explored(explored) {
-        s = time / NS;
-        time -= NS * s;
-        ms = time / (NS/MS);
-        time -= NS/MS * ms;
-        us = time / (NS/US);
-        time -= NS/US * us;
-        ns = time;
+inline bool packed_is_op(int code) {
+    return code >= PACKED_ADD;
+}
+
+// replace the left most open node
+inline Packed packed_fill_left(Packed expr, int code) {
+    int length = packed_length(expr);
+    expr &= ~((Packed)0xF << 60);
+    return expr | ((Packed)code << (4 * length)) | ((Packed)(length + 1) << 60);
+}
+
+// replace the only (and so last) open node with a complete expression
+inline Packed packed_append(Packed expr, Packed sub) {
+    for (int i = 0; i < packed_length(sub); i++) expr = packed_fill_left(expr, packed_code(sub, i));
+    return expr;
+}
+
+// number of open nodes
+inline int packed_size(Packed expr) {
+    int open = 1;
+    for (int i = 0; i < packed_length(expr); i++) open += packed_is_op(packed_code(expr, i)) ? 1 : -1;
+    return open;
+}
+
+// bit mask of the numbers used
+inline unsigned packed_used(Packed expr) {
+    unsigned used = 0;
+    for (int i = 0; i < packed_length(expr); i++) {
+        int code = packed_code(expr, i);
+        if (!packed_is_op(code)) used |= 1u << code;
+    }
+    return used;
+}
+
+inline double packed_apply(int code, double lhs, double rhs) {
+    switch (code) {
+        case PACKED_ADD: return Add::eval(lhs, rhs);
+        case PACKED_SUB: return Sub::eval(lhs, rhs);
+        case PACKED_MUL: return Mul::eval(lhs, rhs);
+        default: return Div::eval(lhs, rhs);
+    }
+}
+
+// prefix order evaluates right to left on a small stack
+double packed_evaluate(Packed expr, const vector<double> &numbers) {
+    double stack[PACKED_NUMBERS];
+    int top = 0;
+
+    for (int i = packed_length(expr) - 1; i >= 0; i--) {
+        int code = packed_code(expr, i);
+        if (!packed_is_op(code)) {
+            stack[top++] = numbers[code];
+        } else {
+            if (top < 2) throw OpenNodeEvalException();
+            double lhs = stack[--top];
+            double rhs = stack[--top];
+            stack[top++] = packed_apply(code, lhs, rhs);
+        }
+    }
+
+    if (top != 1) throw OpenNodeEvalException();
+    return stack[0];
+}
+
+// whether every complete subexpression of a partial expression with open
+// nodes left is a positive integer, as Countdown rules want; and the value
+// of a complete one. The open nodes are the last in prefix order, so they
+// are the first on the stack, with unknown values.
+bool packed_countdown(Packed expr, int open, const vector<double> &numbers, double &value) {
+    double stack[2 * PACKED_NUMBERS];
+    int top = 0;
+    while (top < open) stack[top++] = NAN;
+
+    for (int i = packed_length(expr) - 1; i >= 0; i--) {
+        int code = packed_code(expr, i);
+        if (!packed_is_op(code)) {
+            stack[top++] = numbers[code];
+        } else {
+            double lhs = stack[--top];
+            double rhs = stack[--top];
+            if (isnan(lhs) || isnan(rhs)) {
+                stack[top++] = NAN;
+                continue;
+            }
+            double result = packed_apply(code, lhs, rhs);
+            if (result <= 0. || result != floor(result)) return false;
+            stack[top++] = result;
+        }
+    }
+
+    value = stack[0];
+    return true;
+}
+
+// same semantics as Expr::evaluate_missing, i is the position in prefix order
+double packed_evaluate_missing(Packed expr, const vector<double> &numbers, int &i, bool &open) {
+    if (i >= packed_length(expr)) {
+        i++;
+        open = true;
+        return 0.;
+    }
+
+    int code = packed_code(expr, i++);
+    if (!packed_is_op(code)) {
+        open = false;
+        return numbers[code];
+    }
+
+    bool left_open, right_open;
+    double left = packed_evaluate_missing(expr, numbers, i, left_open);
+    double right = packed_evaluate_missing(expr, numbers, i, right_open);
+    open = left_open && right_open;
+
+    if (left_open) return right;
+    else if (right_open) return left;
+    else return 0.;
+}
+
+double packed_evaluate_missing(Packed expr, const vector<double> &numbers) {
+    int i = 0;
+    bool open;
+    return packed_evaluate_missing(expr, numbers, i, open);
+}
+
+// value of the complete subtree starting at position i
+double packed_evaluate_at(Packed expr, const vector<double> &numbers, int &i) {
+    int code = packed_code(expr, i++);
+    if (!packed_is_op(code)) return numbers[code];
+    double lhs = packed_evaluate_at(expr, numbers, i);
+    double rhs = packed_evaluate_at(expr, numbers, i);
+    return packed_apply(code, lhs, rhs);
+}
+
+// the only open node is the last leaf, so it lies on the right spine
+double packed_required(Packed expr, const vector<double> &numbers, double target) {
+    int i = 0;
+    while (i < packed_length(expr)) {
+        int code = packed_code(expr, i++);
+        double lhs = packed_evaluate_at(expr, numbers, i);
+        switch (code) {
+            case PACKED_ADD: target = Add::solve_right(target, lhs); break;
+            case PACKED_SUB: target = Sub::solve_right(target, lhs); break;
+            case PACKED_MUL: target = Mul::solve_right(target, lhs); break;
+            default: target = Div::solve_right(target, lhs); break;
+        }
+    }
+    return target;
+}
+
+shared_ptr<Expr> unpack(Packed expr, const vector<double> &numbers, int &i) {
+    if (i >= packed_length(expr)) {
+        i++;
+        return make_shared<Open>();
+    }
+
+    int code = packed_code(expr, i++);
+    if (!packed_is_op(code)) return make_shared<Lit>(numbers[code]);
+
+    shared_ptr<Expr> left = unpack(expr, numbers, i);
+    shared_ptr<Expr> right = unpack(expr, numbers, i);
+    switch (code) {
+        case PACKED_ADD: return make_shared<Op<Add>>(left, right);
+        case PACKED_SUB: return make_shared<Op<Sub>>(left, right);
+        case PACKED_MUL: return make_shared<Op<Mul>>(left, right);
+        default: return make_shared<Op<Div>>(left, right);
+    }
+}
+
+shared_ptr<Expr> unpack(Packed expr, const vector<double> &numbers) {
+    int i = 0;
+    return unpack(expr, numbers, i);
+}
+
+struct PackedBest {
+    Packed expr;
+    double value;
+
+    PackedBest() : expr(PACKED_OPEN), value(0.0) {}
+    PackedBest(Packed expr, const vector<double> &numbers) : expr(expr), value(0.0) {
+        try {
+            value = packed_evaluate(expr, numbers);
+        } catch (DivisionByZeroException &e) {
+            value = 0.0;
+        }
     }
 };
 
-ostream& operator<<(ostream &os, const Metrics &metrics) {
-    os << "best: " << std::setfill(' ') << std::setw(30) << metrics.best << ", explored " << std::setfill(' ') << std::setw(10) << metrics.explored << " nodes in "
-        << std::setfill('0') << std::setw(3) << metrics.s 
-        << " . " << std::setfill('0') << std::setw(3) << metrics.ms 
-        << " " << std::setfill('0') << std::setw(3) << metrics.us 
-        << " " << std::setfill('0') << std::setw(3) << metrics.ns << " seconds";
-    return os;
+bool better(const PackedBest &lhs, const PackedBest &rhs, double target) {
+    return abs(lhs.value - target) < abs(rhs.value - target);
 }
 
-Metrics run(function<Best(long long&)> task) {
-    long long explored = 0;
-    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
-    Best best = task(explored);
-    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+Best unpack(const PackedBest &best, const vector<double> &numbers) {
+    if (best.expr == PACKED_OPEN) return Best();
+    return Best(unpack(best.expr, numbers));
+}
 
-    return Metrics(best, explored, chrono::duration_cast<chrono::nanoseconds> (end - begin).count());
+// numbers are sorted so equal numbers are adjacent, only the first unused
+// one of a run of equal numbers is tried
+inline bool packed_duplicate(const vector<double> &numbers, unsigned remaining, int i) {
+    return i > 0 && numbers[i] == numbers[i-1] && (remaining & (1u << (i-1)));
 }
 
-void run_test(double target, set<double> numbers) {
-    cout << "target: " << target << endl;
-    cout << "numbers: ";
-    for (double number : numbers) cout << number << " ";
-    cout << endl;
+// the mask of the same numbers taken first among equal ones
+unsigned canonical_mask(const vector<double> &numbers, unsigned mask) {
+    unsigned result = 0;
+    for (size_t i = 0, j; i < numbers.size(); i = j) {
+        int count = 0;
+        for (j = i; j < numbers.size() && numbers[j] == numbers[i]; j++) count += mask >> j & 1;
+        for (int k = 0; k < count; k++) result |= 1u << (i + k);
+    }
+    return result;
+}
 
-    Metrics m_dfs = run([target, numbers](long long &explored){
-        return dfs(make_shared<Open>(), target, numbers, Best(), explored);
-    });
-    cout << "DFS        " << m_dfs << endl;
+// renumber the codes of a complete expression from the numbers of one mask
+// to those of another with the same numbers, in order
+Packed packed_remap(Packed expr, unsigned from, unsigned to) {
+    int targets[PACKED_NUMBERS];
+    for (int i = 0; i < PACKED_NUMBERS; i++) {
+        if (!(from >> i & 1)) continue;
+        targets[i] = __builtin_ctz(to);
+        to &= to - 1;
+    }
 
-    Metrics astar_count = run([target, numbers](long long &explored){
-        return astar(target, numbers, explored, false, false, [numbers](shared_ptr<Expr> expr){ return numbers.size() - expr->numbers().size(); });
-    });
-    cout << "SRCH CNT   " << astar_count << endl;
+    Packed result = PACKED_OPEN;
+    for (int i = 0; i < packed_length(expr); i++) {
+        int code = packed_code(expr, i);
+        result = packed_fill_left(result, packed_is_op(code) ? code : targets[code]);
+    }
+    return result;
+}
 
-    Metrics astar_diff = run([target, numbers](long long &explored){
-        return astar(target, numbers, explored, false, false, [target](shared_ptr<Expr> expr){ return abs(target - expr->evaluate_missing()); });
-    });
-    cout << "SRCH DIFF  " << astar_diff << endl;
+vector<double> packed_numbers(vector<double> numbers) {
+    if (numbers.size() > PACKED_NUMBERS) throw TooManyNumbersException();
+    sort(numbers.begin(), numbers.end());
+    return numbers;
+}
 
-    Metrics astar_frac = run([target, numbers](long long &explored){
-        return astar(target, numbers, explored, false, false, [target](shared_ptr<Expr> expr){ 
-            double div = target / expr->evaluate_missing(); 
-            if (div < 1.0) div = 1. / div;
-            return div;
-        });
-    });
-    cout << "SRCH DV LG " << astar_frac << endl;
+/********************************************************************
+PACKED DEPTH FIRST SEARCH
+********************************************************************/
 
-    Metrics astar_div = run([target, numbers](long long &explored){
-        return astar(target, numbers, explored, false, false, [target](shared_ptr<Expr> expr){ 
-            double div = target / expr->evaluate_missing(); 
-            if (div > 1.0) div = 1. / div;
-            return div;
-        });
-    });
-    cout << "SRCH DV SM " << astar_div << endl;
+void dfs_packed(Packed expr, int open, unsigned remaining, double target, const vector<double> &numbers, PackedBest &best, long long &explored, const Scoring &scoring) {
+    explored++;
+
+    if (remaining == 0 && open == 0) {
+        // in this case we're on a leaf
+        PackedBest current(expr, numbers);
+        if (better(current, best, target)) best = current;
+    } else if (remaining != 0 && open > 0) {
+        for (int i = 0; i < (int)numbers.size(); i++) {
+            if (!(remaining & (1u << i)) || packed_duplicate(numbers, remaining, i)) continue;
+            dfs_packed(packed_fill_left(expr, i), open - 1, remaining & ~(1u << i), target, numbers, best, explored, scoring);
+
+            // lucky stop
+            if (scoring.done(best.value, target)) return;
+        }
+
+        if (open < __builtin_popcount(remaining)) { // avoid infinite recursion
+            for (int code = PACKED_ADD; code <= PACKED_DIV; code++) {
+                dfs_packed(packed_fill_left(expr, code), open + 1, remaining, target, numbers, best, explored, scoring);
+                if (scoring.done(best.value, target)) return;
+            }
+        }
+    }
 }
 
-int main() {
-    run_test(25.0, {1., 2., 3., 4.});
-    run_test(525.0, {5., 7., 10., 13});
-    run_test(25.0, {1., 2., 3., 4., 5.});
-    run_test(147.0, {4., 5., 8., 20., 27.});
-    run_test(432.0, {3., 5., 7., 11., 13.});
-    run_test(737.0, {1., 4., 5., 6., 7., 25.});
-    run_test(728.0, {6., 10., 25., 75., 5., 50.});
+Best dfs_packed(double target, vector<double> numbers, long long &explored, const Scoring &scoring = Scoring()) {
+    numbers = packed_numbers(numbers);
+    PackedBest best;
+    dfs_packed(PACKED_OPEN, 1, (1u << numbers.size()) - 1, target, numbers, best, explored, scoring);
+    return unpack(best, numbers);
+}
+
+/********************************************************************
+PACKED A* SEARCH
+********************************************************************/
+
+// nodes, memo keys and memo values are all plain words
+struct PackedNode {
+    double dist;
+    Packed expr;
+
+    PackedNode(double dist, Packed expr) : dist(dist), expr(expr) {}
+};
+
+bool operator<(const PackedNode &lhs, const PackedNode &rhs) {
+    return lhs.dist > rhs.dist;
+}
+
+typedef vector<map<double, Packed>> PackedMem;
+
+inline uint64_t packed_key(double value) {
+    uint64_t key;
+    memcpy(&key, &value, sizeof(key));
+    return key;
+}
+
+void emplace(Packed expr, double target, unsigned remaining, const vector<double> &numbers, priority_queue<PackedNode> &q, function<double(Packed)> &heuristic, PackedBest &best, PackedMem &mem, bool use_mem, long long &explored) {
+    explored++;
+
+    // only emplace if the expression is not evaluable
+    if (packed_size(expr) == 0) {
+        if (remaining == 0) {
+            PackedBest opt(expr, numbers);
+            if (better(opt, best, target)) best = opt;
+        }
+
+        if (use_mem) {
+            try {
+                double outcome = packed_evaluate(expr, numbers);
+                unsigned used = packed_used(expr), key = canonical_mask(numbers, used);
+                mem[key][outcome] = packed_remap(expr, used, key);
+            } catch (DivisionByZeroException &e) {}
+        }
+    } else {
+        q.emplace(heuristic(expr), expr);
+    }
+}
+
+Best astar_packed(double target, vector<double> numbers, long long &explored, bool use_mem, function<double(Packed)> heuristic, const Scoring &scoring = Scoring()) {
+    numbers = packed_numbers(numbers);
+    unsigned all = (1u << numbers.size()) - 1;
+    PackedBest best;
+
+    priority_queue<PackedNode> q;
+    q.emplace(heuristic(PACKED_OPEN), PACKED_OPEN);
+    explored++;
+
+    PackedMem mem(use_mem ? all + 1 : 0);
+
+    while (!q.empty() && !scoring.done(best.value, target)) {
+        Packed cur = q.top().expr;
+        q.pop();
 
-    return 0;
-}
\ No newline at end of file
+        int open = packed_size(cur);
+        unsigned remaining = all & ~packed_used(cur);
+
+        if (use_mem && open == 1) {
+            // memo entries are over the first of equal numbers
+            unsigned key = canonical_mask(numbers, remaining);
+            Packed answer = PACKED_OPEN;
+            bool found = scan_window(mem[key], target, scoring.tolerance(), [&](double value) { return packed_required(cur, numbers, value); }, [&](Packed sub) {
+                try {
+                    // the value can still be off, as for 0 / x
+                    answer = packed_append(cur, packed_remap(sub, key, remaining));
+                    return scoring.done(packed_evaluate(answer, numbers), target);
+                } catch (DivisionByZeroException &e) {
+                    return false;
+                }
+            });
+            if (found) return unpack(PackedBest(answer, numbers), numbers);
+        }
+
+        // expand children
+        for (int i = 0; i < (int)numbers.size(); i++) {
+            if (!(remaining & (1u << i)) || packed_duplicate(numbers, remaining, i)) continue;
+            emplace(packed_fill_left(cur, i), target, remaining & ~(1u << i), numbers, q, heuristic, best, mem, use_mem, explored);
+        }
+
+        if (open < __builtin_popcount(remaining)) {
+            for (int code = PACKED_ADD; code <= PACKED_DIV; code++) {
+                emplace(packed_fill_left(cur, code), target, remaining, numbers, q, heuristic, best, mem, use_mem, explored);
+            }
+        }
+    }
+
+    return unpack(best, numbers);
+}
+
+/********************************************************************
+RANKING EXPRESSIONS
+********************************************************************/
+
+// The complete expressions over all n numbers are numbered 0 .. total-1.
+// A rank is split as ((shape * ops + operators) * perms + permutation):
+// the tree shape, one of 4^(n-1) operator assignments in prefix order, and
+// a permutation of the numbers over the leaves. Equal numbers are not told
+// apart, permutations are of the multiset, so each expression occurs once.
+struct ExprSpace {
+    vector<double> numbers;
+    vector<int> values; // for each number the index of its distinct value
+    int n;
+    uint64_t shapes, ops, perms, total;
+
+    ExprSpace(vector<double> numbers);
+};
+
+// number of ways to finish a shape with open slots and leaves still to place
+// filled in whole before first use, so the searching threads only read it
+struct ShapeTable {
+    uint64_t counts[PACKED_NUMBERS + 2][PACKED_NUMBERS + 2];
+
+    ShapeTable() : counts() {
+        counts[0][0] = 1;
+        for (int leaves = 1; leaves <= PACKED_NUMBERS; leaves++) {
+            // from the most open slots down, a leaf sorts before an operator
+            for (int open = leaves; open >= 1; open--) {
+                counts[open][leaves] = counts[open - 1][leaves - 1] + (open < leaves ? counts[open + 1][leaves] : 0);
+            }
+        }
+    }
+};
+
+uint64_t shape_count(int open, int leaves) {
+    static const ShapeTable table;
+    if (open < 0 || open > leaves || leaves > PACKED_NUMBERS) return 0;
+    return table.counts[open][leaves];
+}
+
+uint64_t factorial(int n) {
+    uint64_t result = 1;
+    for (int i = 2; i <= n; i++) result *= i;
+    return result;
+}
+
+// number of distinct arrangements of a multiset given by value counts
+uint64_t multiset_perms(const vector<int> &counts) {
+    int n = 0;
+    uint64_t divisor = 1;
+    for (int count : counts) {
+        n += count;
+        divisor *= factorial(count);
+    }
+    return factorial(n) / divisor;
+}
+
+ExprSpace::ExprSpace(vector<double> numbers) : numbers(packed_numbers(numbers)), n(numbers.size()) {
+    vector<int> counts;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || this->numbers[i] != this->numbers[i-1]) counts.push_back(0);
+        counts.back()++;
+        values.push_back(counts.size() - 1);
+    }
+
+    shapes = n == 0 ? 0 : shape_count(1, n);
+    ops = 1;
+    for (int i = 1; i < n; i++) ops *= 4;
+    perms = multiset_perms(counts);
+    total = shapes * ops * perms;
+}
+
+// build the expression from its parts, leaves hold distinct value indices
+Packed compose(const ExprSpace &space, uint64_t shape, uint64_t ops, const vector<int> &leaves) {
+    Packed expr = PACKED_OPEN;
+    int open = 1, placed = 0, remaining = space.n;
+    unsigned used = 0;
+
+    // operator digits are read most significant first
+    uint64_t weight = space.ops / 4;
+
+    while (open > 0) {
+        uint64_t leaf_first = shape_count(open - 1, remaining - 1);
+        if (shape < leaf_first) {
+            // first unused number with this value
+            int value = leaves[placed++], i = 0;
+            while (space.values[i] != value || (used & (1u << i))) i++;
+            used |= 1u << i;
+            expr = packed_fill_left(expr, i);
+            open--;
+            remaining--;
+        } else {
+            shape -= leaf_first;
+            expr = packed_fill_left(expr, PACKED_ADD + (int)(ops / weight % 4));
+            weight /= 4;
+            open++;
+        }
+    }
+
+    return expr;
+}
+
+Packed unrank_expr(const ExprSpace &space, uint64_t rank) {
+    uint64_t perm = rank % space.perms;
+    rank /= space.perms;
+    uint64_t ops = rank % space.ops;
+    uint64_t shape = rank / space.ops;
+
+    vector<int> counts;
+    for (int value : space.values) {
+        if (value == (int)counts.size()) counts.push_back(0);
+        counts[value]++;
+    }
+
+    // lexicographic unranking of a multiset permutation
+    vector<int> leaves;
+    for (int position = 0; position < space.n; position++) {
+        for (int value = 0; value < (int)counts.size(); value++) {
+            if (counts[value] == 0) continue;
+            counts[value]--;
+            uint64_t block = multiset_perms(counts);
+            if (perm < block) {
+                leaves.push_back(value);
+                break;
+            }
+            perm -= block;
+            counts[value]++;
+        }
+    }
+
+    return compose(space, shape, ops, leaves);
+}
+
+uint64_t rank_expr(const ExprSpace &space, Packed expr) {
+    vector<int> counts;
+    for (int value : space.values) {
+        if (value == (int)counts.size()) counts.push_back(0);
+        counts[value]++;
+    }
+
+    uint64_t shape = 0, ops = 0, perm = 0;
+    int open = 1, remaining = space.n;
+
+    for (int i = 0; i < packed_length(expr); i++) {
+        int code = packed_code(expr, i);
+        if (packed_is_op(code)) {
+            shape += shape_count(open - 1, remaining - 1);
+            ops = ops * 4 + (code - PACKED_ADD);
+            open++;
+        } else {
+            int leaf = space.values[code];
+            for (int value = 0; value < leaf; value++) {
+                if (counts[value] == 0) continue;
+                counts[value]--;
+                perm += multiset_perms(counts);
+                counts[value]++;
+            }
+            counts[leaf]--;
+            open--;
+            remaining--;
+        }
+    }
+
+    return (shape * space.ops + ops) * space.perms + perm;
+}
+
+// walks a range of ranks in order without unranking every expression
+struct ExprCursor {
+    const ExprSpace &space;
+    uint64_t shape, ops;
+    vector<int> leaves;
+
+    ExprCursor(const ExprSpace &space, uint64_t rank) : space(space) {
+        Packed expr = unrank_expr(space, rank);
+        shape = rank / space.perms / space.ops;
+        ops = rank / space.perms % space.ops;
+        for (int i = 0; i < packed_length(expr); i++) {
+            int code = packed_code(expr, i);
+            if (!packed_is_op(code)) leaves.push_back(space.values[code]);
+        }
+    }
+
+    Packed expr() const {
+        return compose(space, shape, ops, leaves);
+    }
+
+    void next() {
+        // next_permutation visits multiset permutations in lexicographic order
+        if (next_permutation(leaves.begin(), leaves.end())) return;
+        if (++ops < space.ops) return;
+        ops = 0;
+        shape++;
+    }
+};
+
+// evaluates the expressions with rank in [begin, end), returns the rank to
+// resume from: end, or one past a rank that reached the top tier
+uint64_t search_range(const ExprSpace &space, double target, uint64_t begin, uint64_t end, PackedBest &best, long long &explored, const Scoring &scoring = Scoring()) {
+    if (begin >= end) return end;
+
+    ExprCursor cursor(space, begin);
+    for (uint64_t r = begin; r < end; r++, cursor.next()) {
+        explored++;
+        PackedBest current(cursor.expr(), space.numbers);
+        if (better(current, best, target)) best = current;
+
+        // lucky stop
+        if (scoring.done(best.value, target)) return r + 1;
+    }
+
+    return end;
+}
+
+// splits the expression space in equal contiguous ranges over threads
+Best parallel_search(double target, vector<double> numbers, int threads, long long &explored, const Scoring &scoring = Scoring()) {
+    if (threads < 1) threads = 1;
+    ExprSpace space(numbers);
+    vector<PackedBest> bests(threads);
+    vector<long long> counts(threads, 0);
+    atomic<bool> found(false);
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            uint64_t begin = space.total / threads * t + min<uint64_t>(t, space.total % threads);
+            uint64_t end = begin + space.total / threads + (t < (int)(space.total % threads) ? 1 : 0);
+
+            // check for a lucky stop elsewhere every so many expressions
+            const uint64_t step = 1 << 14;
+            while (begin < end && !found) {
+                begin = search_range(space, target, begin, min(end, begin + step), bests[t], counts[t], scoring);
+                if (scoring.done(bests[t].value, target)) found = true;
+            }
+        });
+    }
+    for (thread &worker : workers) worker.join();
+
+    PackedBest best;
+    for (int t = 0; t < threads; t++) {
+        explored += counts[t];
+        if (better(bests[t], best, target)) best = bests[t];
+    }
+    return unpack(best, space.numbers);
+}
+
+/********************************************************************
+SAMPLING EXPRESSIONS
+********************************************************************/
+
+// uniform over the complete expressions, since ranks are; an open node
+// when there are none
+Packed sample_expr(const ExprSpace &space, mt19937_64 &rng) {
+    if (space.total == 0) return PACKED_OPEN;
+    uniform_int_distribution<uint64_t> pick(0, space.total - 1);
+    return unrank_expr(space, pick(rng));
+}
+
+struct Estimate {
+    double fraction, error;
+    long long samples;
+};
+
+ostream& operator<<(ostream &os, const Estimate &estimate) {
+    os << std::fixed << std::setprecision(4) << 100. * estimate.fraction << "% +- " << 100. * estimate.error << "% over " << estimate.samples << " samples";
+    os.unsetf(ios_base::floatfield);
+    os << std::setprecision(6);
+    return os;
+}
+
+// Monte Carlo estimate of the fraction of expressions within distance of
+// the target, a quick predictor of how solvable a puzzle is
+Estimate estimate_density(double target, vector<double> numbers, double distance, long long samples, mt19937_64 &rng) {
+    Estimate estimate = {0., 0., 0};
+    if (numbers.empty()) return estimate;
+
+    ExprSpace space(numbers);
+    long long hits = 0;
+
+    for (long long i = 0; i < samples; i++) {
+        try {
+            if (abs(packed_evaluate(sample_expr(space, rng), space.numbers) - target) <= distance) hits++;
+        } catch (DivisionByZeroException &e) {}
+    }
+
+    estimate.samples = samples;
+    estimate.fraction = samples > 0 ? (double)hits / samples : 0.;
+    estimate.error = samples > 0 ? sqrt(estimate.fraction * (1. - estimate.fraction) / samples) : 0.;
+    return estimate;
+}
+
+/********************************************************************
+SUBSET TABLES
+********************************************************************/
+
+// For every subset of the numbers (a bit mask) the sorted distinct values
+// of all expressions using exactly those numbers. The values of a subset
+// follow from its splits in two nonempty parts, so tables are built from
+// small subsets up and the full set decides reachability exactly.
+//
+// Under the free rules any intermediate value is allowed and all numbers
+// must be used. Under the Countdown rules every intermediate value must be
+// a positive integer, and any nonempty subset of the numbers may be used.
+#define RULES_FREE 0
+#define RULES_COUNTDOWN 1
+
+struct SubsetTables {
+    vector<double> numbers;
+    vector<vector<double>> values;
+    int rules;
+
+    SubsetTables() : rules(RULES_FREE) {}
+    SubsetTables(vector<double> numbers, int rules = RULES_FREE) : numbers(numbers), values((size_t)1 << numbers.size()), rules(rules) {}
+};
+
+// all values of lhs op rhs and rhs op lhs, returns the number generated
+long long combine(const vector<double> &lhs, const vector<double> &rhs, vector<double> &out, int rules) {
+    size_t before = out.size();
+    for (double x : lhs) {
+        for (double y : rhs) {
+            if (rules == RULES_COUNTDOWN) {
+                out.push_back(Add::eval(x, y));
+                if (x != y) out.push_back(abs(Sub::eval(x, y)));
+                out.push_back(Mul::eval(x, y));
+                if (fmod(x, y) == 0.0) out.push_back(Div::eval(x, y));
+                else if (fmod(y, x) == 0.0) out.push_back(Div::eval(y, x));
+            } else {
+                out.push_back(Add::eval(x, y));
+                out.push_back(Sub::eval(x, y));
+                out.push_back(Sub::eval(y, x));
+                out.push_back(Mul::eval(x, y));
+                if (y != 0.0) out.push_back(Div::eval(x, y));
+                if (x != 0.0) out.push_back(Div::eval(y, x));
+            }
+        }
+    }
+    return out.size() - before;
+}
+
+inline long long thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Limits on building tables, checked before every split is combined. Memory
+// is charged for the values a split can generate before generating them.
+struct Budget {
+    long long cpu_ns; // thread cpu time, 0 for none
+    size_t memory; // bytes of values, 0 for none
+    chrono::steady_clock::time_point deadline; // the epoch for none
+    long long cpu_start;
+    size_t used;
+
+    Budget(long long cpu_ns = 0, size_t memory = 0) : cpu_ns(cpu_ns), memory(memory), cpu_start(thread_cpu_ns()), used(0) {}
+
+    void charge(size_t values) {
+        used += values * sizeof(double);
+        if (memory > 0 && used > memory) throw BudgetExceededException();
+        if (cpu_ns > 0 && thread_cpu_ns() - cpu_start > cpu_ns) throw BudgetExceededException();
+        if (deadline.time_since_epoch().count() > 0 && chrono::steady_clock::now() > deadline) throw DeadlineExceededException();
+    }
+
+    void refund(size_t values) {
+        used -= values * sizeof(double);
+    }
+};
+
+// the subsets of mask must be computed already
+long long compute_subset(SubsetTables &tables, unsigned mask, Budget *budget = nullptr) {
+    vector<double> &values = tables.values[mask];
+    values.clear();
+
+    if (__builtin_popcount(mask) == 1) {
+        values.push_back(tables.numbers[__builtin_ctz(mask)]);
+        return 1;
+    }
+
+    // every unordered split once, the part with the lowest number on the left
+    long long generated = 0;
+    size_t charged = 0;
+    unsigned low = mask & -mask;
+    for (unsigned left = (mask - 1) & mask; left > 0; left = (left - 1) & mask) {
+        if (!(left & low)) continue;
+        if (budget) {
+            size_t bound = 6 * tables.values[left].size() * tables.values[mask ^ left].size();
+            budget->charge(bound);
+            charged += bound;
+        }
+        generated += combine(tables.values[left], tables.values[mask ^ left], values, tables.rules);
+    }
+
+    sort(values.begin(), values.end());
+    values.erase(unique(values.begin(), values.end()), values.end());
+    if (budget) {
+        budget->refund(charged - values.size());
+        budget->charge(0);
+    }
+    return generated;
+}
+
+// submasks always precede their supersets in numeric order
+SubsetTables build_tables(vector<double> numbers, long long &explored, bool full = true, int rules = RULES_FREE, Budget *budget = nullptr) {
+    if (numbers.size() > 8 * sizeof(unsigned) - 1) throw TooManyNumbersException();
+
+    SubsetTables tables(numbers, rules);
+    unsigned all = (1u << numbers.size()) - 1;
+    for (unsigned mask = 1; mask < all + (full ? 1 : 0); mask++) {
+        explored += compute_subset(tables, mask, budget);
+    }
+    return tables;
+}
+
+// values is a sorted vector or a view of one
+template <typename Values>
+bool reachable(const Values &values, double target) {
+    return binary_search(values.begin(), values.end(), target);
+}
+
+// closest value by binary search, values must not be empty
+template <typename Values>
+double closest(const Values &values, double target) {
+    auto it = lower_bound(values.begin(), values.end(), target);
+    if (it == values.end()) return values.back();
+    if (it != values.begin() && abs(*(it - 1) - target) <= abs(*it - target)) return *(it - 1);
+    return *it;
+}
+
+// the subset and value closest to the target the rules allow, tables must
+// not be empty. The subsets stop once one is in the top tier.
+template <typename Tables>
+double closest(const Tables &tables, double target, unsigned &mask, const Scoring &scoring = Scoring()) {
+    unsigned all = tables.values.size() - 1;
+    mask = all;
+    double best = closest(tables.values[all], target);
+    if (tables.rules != RULES_COUNTDOWN) return best;
+
+    for (unsigned subset = 1; subset < all && !scoring.done(best, target); subset++) {
+        double value = closest(tables.values[subset], target);
+        if (abs(value - target) < abs(best - target)) {
+            best = value;
+            mask = subset;
+        }
+    }
+    return best;
+}
+
+// the right hand sides that could make value with lhs, in the order of combine
+int required_right(double value, double x, double required[6]) {
+    required[0] = Add::solve_right(value, x);
+    required[1] = Sub::solve_right(value, x);
+    required[2] = Sub::solve_left(value, x);
+    required[3] = Mul::solve_right(value, x);
+    required[4] = Div::solve_right(value, x);
+    required[5] = Div::solve_left(value, x);
+    return 6;
+}
+
+shared_ptr<Expr> make_op(int op, double x, double y, shared_ptr<Expr> lhs, shared_ptr<Expr> rhs, double &value) {
+    switch (op) {
+        case 0: value = Add::eval(x, y); return make_shared<Op<Add>>(lhs, rhs);
+        case 1: value = Sub::eval(x, y); return make_shared<Op<Sub>>(lhs, rhs);
+        case 2: value = Sub::eval(y, x); return make_shared<Op<Sub>>(rhs, lhs);
+        case 3: value = Mul::eval(x, y); return make_shared<Op<Mul>>(lhs, rhs);
+        case 4: value = y != 0.0 ? Div::eval(x, y) : NAN; return make_shared<Op<Div>>(lhs, rhs);
+        default: value = x != 0.0 ? Div::eval(y, x) : NAN; return make_shared<Op<Div>>(rhs, lhs);
+    }
+}
+
+// finds the split and operation that produce value, trying the needed
+// right hand side by binary search first and falling back to all pairs for
+// values that rounding keeps from being solved for exactly
+template <typename Tables>
+bool find_split(const Tables &tables, unsigned mask, double value, unsigned &left, double &x, double &y, int &op) {
+    unsigned low = mask & -mask;
+    for (int exhaustive = 0; exhaustive < 2; exhaustive++) {
+        for (left = (mask - 1) & mask; left > 0; left = (left - 1) & mask) {
+            if (!(left & low)) continue;
+            const auto &rhs = tables.values[mask ^ left];
+            for (double lhs : tables.values[left]) {
+                x = lhs;
+                double required[6];
+                required_right(value, x, required);
+                for (op = 0; op < 6; op++) {
+                    if (exhaustive) {
+                        for (double candidate : rhs) {
+                            y = candidate;
+                            double made;
+                            make_op(op, x, y, nullptr, nullptr, made);
+                            if (made == value) return true;
+                        }
+                    } else if (reachable(rhs, required[op])) {
+                        y = required[op];
+                        double made;
+                        make_op(op, x, y, nullptr, nullptr, made);
+                        if (made == value) return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// an expression over exactly the numbers in mask with the given value
+template <typename Tables>
+shared_ptr<Expr> reconstruct(const Tables &tables, unsigned mask, double value) {
+    if (__builtin_popcount(mask) == 1) return make_shared<Lit>(tables.numbers[__builtin_ctz(mask)]);
+
+    unsigned left;
+    double x, y, made;
+    int op;
+    if (!find_split(tables, mask, value, left, x, y, op)) return make_shared<Open>();
+    return make_op(op, x, y, reconstruct(tables, left, x), reconstruct(tables, mask ^ left, y), made);
+}
+
+// same as reconstruct, with codes referring to the position in the numbers
+template <typename Tables>
+Packed reconstruct_packed(const Tables &tables, unsigned mask, double value) {
+    if (__builtin_popcount(mask) == 1) return packed_fill_left(PACKED_OPEN, __builtin_ctz(mask));
+
+    unsigned left;
+    double x, y;
+    int op;
+    if (!find_split(tables, mask, value, left, x, y, op)) return PACKED_OPEN;
+
+    // operations 2 and 5 put the right part first
+    static const int codes[6] = {PACKED_ADD, PACKED_SUB, PACKED_SUB, PACKED_MUL, PACKED_DIV, PACKED_DIV};
+    Packed lhs = reconstruct_packed(tables, left, x);
+    Packed rhs = reconstruct_packed(tables, mask ^ left, y);
+    if (op == 2 || op == 5) swap(lhs, rhs);
+    return packed_append(packed_append(packed_fill_left(PACKED_OPEN, codes[op]), lhs), rhs);
+}
+
+Best dp_solve(double target, vector<double> numbers, long long &explored, int rules = RULES_FREE, const Scoring &scoring = Scoring()) {
+    if (numbers.empty()) return Best();
+
+    SubsetTables tables = build_tables(numbers, explored, true, rules);
+    unsigned mask;
+    double value = closest(tables, target, mask, scoring);
+    return Best(reconstruct(tables, mask, value));
+}
+
+// decides reachability without the full set table: the last operation
+// combines two complementary subsets, so for every split and every value
+// on the left the needed right hand side is looked up. Returns an open node
+// when the target cannot be made.
+shared_ptr<Expr> solve_mitm(const SubsetTables &tables, double target) {
+    unsigned all = tables.values.size() - 1;
+    if (all == 1) return tables.numbers[0] == target ? make_shared<Lit>(target) : shared_ptr<Expr>(make_shared<Open>());
+
+    unsigned left;
+    double x, y, made;
+    int op;
+    if (!find_split(tables, all, target, left, x, y, op)) return make_shared<Open>();
+    return make_op(op, x, y, reconstruct(tables, left, x), reconstruct(tables, all ^ left, y), made);
+}
+
+/********************************************************************
+COUNTING SOLUTIONS
+********************************************************************/
+
+// How many distinct expressions make each value. Expressions are the same
+// when they differ only in the order of the operands of + and *, or in which
+// of two equal numbers they use; so tables are kept for one mask of each
+// multiset of numbers, and each split into two multisets is combined once.
+// Under Countdown rules every subset counts, under free rules the full set.
+struct CountTables {
+    vector<double> numbers; // sorted
+    vector<vector<double>> values; // of canonical masks, sorted
+    vector<vector<uint64_t>> counts; // of each value
+    int rules;
+};
+
+// whether the part takes the first of every run of equal numbers in the mask
+bool leading_part(const vector<double> &numbers, unsigned mask, unsigned part) {
+    for (size_t i = 0; i < numbers.size(); i++) {
+        if (!(mask >> i & 1) || (part >> i & 1)) continue;
+        for (size_t j = i + 1; j < numbers.size() && numbers[j] == numbers[i]; j++) {
+            if ((mask & part) >> j & 1) return false;
+        }
+    }
+    return true;
+}
+
+// The operations on the pair of values at i and j of lhs and rhs that make
+// distinct expressions, as emit(value, op, whether y comes first, whether
+// the pair is unordered). With same both sides are one multiset: the pairs
+// for + and * are unordered, and every ordered pair for - and / comes up in
+// the loop by itself; otherwise both orders are made here.
+template <typename Emit>
+inline void combine_pair(double x, double y, size_t i, size_t j, bool same, bool countdown, Emit emit) {
+    if (!same || i < j) {
+        emit(x + y, PACKED_ADD, false, false);
+        emit(x * y, PACKED_MUL, false, false);
+    } else if (i == j) {
+        emit(x + y, PACKED_ADD, false, true);
+        emit(x * y, PACKED_MUL, false, true);
+    }
+
+    if (countdown) {
+        if (x > y) emit(x - y, PACKED_SUB, false, false);
+        if (fmod(x, y) == 0.0) emit(x / y, PACKED_DIV, false, false);
+        if (!same && y > x) emit(y - x, PACKED_SUB, true, false);
+        if (!same && fmod(y, x) == 0.0) emit(y / x, PACKED_DIV, true, false);
+    } else {
+        emit(x - y, PACKED_SUB, false, false);
+        if (y != 0.0) emit(x / y, PACKED_DIV, false, false);
+        if (!same) emit(y - x, PACKED_SUB, true, false);
+        if (!same && x != 0.0) emit(y / x, PACKED_DIV, true, false);
+    }
+}
+
+// counts of lhs op rhs, an unordered pair of a value with itself made in
+// a(a + 1) / 2 ways
+void count_combine(const CountTables &tables, unsigned lhs, unsigned rhs, bool same, vector<pair<double, uint64_t>> &out) {
+    const vector<double> &xs = tables.values[lhs], &ys = tables.values[rhs];
+    const vector<uint64_t> &as = tables.counts[lhs], &bs = tables.counts[rhs];
+    bool countdown = tables.rules == RULES_COUNTDOWN;
+
+    for (size_t i = 0; i < xs.size(); i++) {
+        for (size_t j = 0; j < ys.size(); j++) {
+            uint64_t ways = as[i] * bs[j], pairs = as[i] * (as[i] + 1) / 2;
+            combine_pair(xs[i], ys[j], i, j, same, countdown, [&](double value, int, bool, bool unordered) {
+                out.emplace_back(value, unordered ? pairs : ways);
+            });
+        }
+    }
+}
+
+CountTables count_tables(vector<double> numbers, int rules = RULES_FREE) {
+    if (numbers.size() > PACKED_NUMBERS) throw TooManyNumbersException();
+    sort(numbers.begin(), numbers.end());
+
+    CountTables tables;
+    tables.numbers = numbers;
+    tables.rules = rules;
+    tables.values.resize((size_t)1 << numbers.size());
+    tables.counts.resize(tables.values.size());
+
+    // a mask comes after all of its parts
+    for (unsigned mask = 1; mask < tables.values.size(); mask++) {
+        if (canonical_mask(numbers, mask) != mask) continue;
+        if (__builtin_popcount(mask) == 1) {
+            tables.values[mask] = {numbers[__builtin_ctz(mask)]};
+            tables.counts[mask] = {1};
+            continue;
+        }
+
+        vector<pair<double, uint64_t>> made;
+        for (unsigned part = (mask - 1) & mask; part > 0; part = (part - 1) & mask) {
+            if (!leading_part(numbers, mask, part)) continue;
+            unsigned lhs = canonical_mask(numbers, part), rhs = canonical_mask(numbers, mask ^ part);
+            if (lhs <= rhs) count_combine(tables, lhs, rhs, lhs == rhs, made);
+        }
+
+        sort(made.begin(), made.end());
+        for (size_t i = 0; i < made.size(); i++) {
+            if (i == 0 || made[i].first != made[i-1].first) {
+                tables.values[mask].push_back(made[i].first);
+                tables.counts[mask].push_back(0);
+            }
+            tables.counts[mask].back() += made[i].second;
+        }
+    }
+
+    return tables;
+}
+
+// the number of expressions making the target, and the fewest operations
+// among them, -1 if there are none
+uint64_t count_solutions(const CountTables &tables, double target, int &operations) {
+    unsigned all = tables.values.size() - 1;
+    uint64_t total = 0;
+    operations = -1;
+    for (unsigned mask = tables.rules == RULES_COUNTDOWN ? 1 : all; mask <= all; mask++) {
+        const vector<double> &values = tables.values[mask];
+        auto it = lower_bound(values.begin(), values.end(), target);
+        if (it == values.end() || *it != target) continue;
+
+        total += tables.counts[mask][it - values.begin()];
+        int used = __builtin_popcount(mask) - 1;
+        if (operations < 0 || used < operations) operations = used;
+    }
+    return total;
+}
+
+// every value made and its number of expressions, by value: one pass over
+// the tables that merges the subsets under Countdown rules
+vector<pair<double, uint64_t>> solution_counts(const CountTables &tables) {
+    unsigned all = tables.values.size() - 1;
+    vector<pair<double, uint64_t>> made;
+    for (unsigned mask = tables.rules == RULES_COUNTDOWN ? 1 : all; mask <= all; mask++) {
+        for (size_t i = 0; i < tables.values[mask].size(); i++) made.emplace_back(tables.values[mask][i], tables.counts[mask][i]);
+    }
+
+    sort(made.begin(), made.end());
+    vector<pair<double, uint64_t>> result;
+    for (const pair<double, uint64_t> &value : made) {
+        if (result.empty() || result.back().first != value.first) result.emplace_back(value.first, 0);
+        result.back().second += value.second;
+    }
+    return result;
+}
+
+// how many values have each number of expressions
+map<uint64_t, size_t> solution_histogram(const vector<pair<double, uint64_t>> &counts) {
+    map<uint64_t, size_t> histogram;
+    for (const pair<double, uint64_t> &value : counts) histogram[value.second]++;
+    return histogram;
+}
+
+/********************************************************************
+SOLUTION FOREST
+********************************************************************/
+
+// All the distinct expressions making a target, as counted by count_tables,
+// shared in an AND-OR graph instead of listed. An OR node is a value over a
+// multiset of the numbers, with one AND edge per operation and pair of
+// nodes that makes it; numbers are nodes without edges. Every node knows how
+// many expressions it stands for, so the solutions are numbered and the
+// k-th one is built on demand by walking down from a root, which serves to
+// iterate, count and sample them without ever listing them all.
+struct ForestEdge {
+    int op;
+    uint32_t lhs, rhs; // in the order of the expression
+    bool unordered; // lhs == rhs under + or *, each pair once
+};
+
+struct ForestNode {
+    double value;
+    unsigned mask; // canonical, over the sorted numbers
+    uint64_t count;
+    uint32_t first, last; // edges
+};
+
+struct SolutionForest {
+    vector<double> numbers; // sorted
+    vector<ForestNode> nodes;
+    vector<ForestEdge> edges;
+    vector<uint32_t> roots;
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (uint32_t root : roots) total += nodes[root].count;
+        return total;
+    }
+};
+
+// the node of value over mask, after all of its children
+uint32_t forest_node(const CountTables &tables, unsigned mask, double value, SolutionForest &forest, map<pair<unsigned, double>, uint32_t> &ids) {
+    auto found = ids.find(make_pair(mask, value));
+    if (found != ids.end()) return found->second;
+
+    vector<ForestEdge> edges;
+    uint64_t count = __builtin_popcount(mask) == 1 ? 1 : 0;
+    bool countdown = tables.rules == RULES_COUNTDOWN;
+    for (unsigned part = (mask - 1) & mask; part > 0 && __builtin_popcount(mask) > 1; part = (part - 1) & mask) {
+        if (!leading_part(tables.numbers, mask, part)) continue;
+        unsigned lhs = canonical_mask(tables.numbers, part), rhs = canonical_mask(tables.numbers, mask ^ part);
+        if (lhs > rhs) continue;
+        const vector<double> &xs = tables.values[lhs], &ys = tables.values[rhs];
+
+        for (size_t i = 0; i < xs.size(); i++) {
+            // the right hand sides that could work, each checked exactly
+            double x = xs[i];
+            set<size_t> candidates;
+            if (x == 0.0 && value == 0.0) {
+                for (size_t j = 0; j < ys.size(); j++) candidates.insert(j);
+            } else {
+                double required[6];
+                required_right(value, x, required);
+                for (double y : required) {
+                    if (!isfinite(y)) continue;
+                    double slack = 1e-9 * (abs(value) + abs(x) + 1.);
+                    for (auto it = lower_bound(ys.begin(), ys.end(), y - slack); it != ys.end() && *it <= y + slack; ++it) candidates.insert(it - ys.begin());
+                }
+            }
+
+            for (size_t j : candidates) {
+                combine_pair(x, ys[j], i, j, lhs == rhs, countdown, [&](double made, int op, bool swapped, bool unordered) {
+                    if (made != value) return;
+                    uint32_t left = forest_node(tables, lhs, x, forest, ids), right = forest_node(tables, rhs, ys[j], forest, ids);
+                    if (swapped) swap(left, right);
+                    uint64_t ways = forest.nodes[left].count;
+                    count += unordered ? ways * (ways + 1) / 2 : ways * forest.nodes[right].count;
+                    edges.push_back(ForestEdge{op, left, right, unordered});
+                });
+            }
+        }
+    }
+
+    uint32_t id = forest.nodes.size();
+    forest.nodes.push_back(ForestNode{value, mask, count, (uint32_t)forest.edges.size(), (uint32_t)(forest.edges.size() + edges.size())});
+    forest.edges.insert(forest.edges.end(), edges.begin(), edges.end());
+    ids[make_pair(mask, value)] = id;
+    return id;
+}
+
+// the forest of the target: one root per multiset of numbers making it
+// under Countdown rules, the full set under free rules
+SolutionForest solution_forest(const CountTables &tables, double target) {
+    SolutionForest forest;
+    forest.numbers = tables.numbers;
+    map<pair<unsigned, double>, uint32_t> ids;
+    unsigned all = tables.values.size() - 1;
+    for (unsigned mask = tables.rules == RULES_COUNTDOWN ? 1 : all; mask <= all; mask++) {
+        if (binary_search(tables.values[mask].begin(), tables.values[mask].end(), target)) forest.roots.push_back(forest_node(tables, mask, target, forest, ids));
+    }
+    return forest;
+}
+
+// the k-th expression of a node, codes referring to the sorted numbers
+Packed forest_expr(const SolutionForest &forest, uint32_t node, uint64_t k) {
+    const ForestNode &n = forest.nodes[node];
+    if (n.first == n.last) return packed_fill_left(PACKED_OPEN, __builtin_ctz(n.mask));
+
+    for (uint32_t e = n.first; e < n.last; e++) {
+        const ForestEdge &edge = forest.edges[e];
+        uint64_t a = forest.nodes[edge.lhs].count, b = forest.nodes[edge.rhs].count;
+        uint64_t ways = edge.unordered ? a * (a + 1) / 2 : a * b;
+        if (k >= ways) {
+            k -= ways;
+            continue;
+        }
+
+        // unordered pairs i <= j are numbered row by row
+        uint64_t i = k / b, j = k % b;
+        if (edge.unordered) {
+            for (i = 0; k >= a - i; i++) k -= a - i;
+            j = i + k;
+        }
+        Packed expr = packed_fill_left(PACKED_OPEN, edge.op);
+        return packed_append(packed_append(expr, forest_expr(forest, edge.lhs, i)), forest_expr(forest, edge.rhs, j));
+    }
+    return PACKED_OPEN;
+}
+
+// the k-th solution, k below forest.count()
+Packed forest_solution(const SolutionForest &forest, uint64_t k) {
+    for (uint32_t root : forest.roots) {
+        if (k < forest.nodes[root].count) return forest_expr(forest, root, k);
+        k -= forest.nodes[root].count;
+    }
+    return PACKED_OPEN;
+}
+
+// a solution drawn uniformly, the forest must not be empty
+Packed forest_sample(const SolutionForest &forest, mt19937_64 &rng) {
+    return forest_solution(forest, uniform_int_distribution<uint64_t>(0, forest.count() - 1)(rng));
+}
+
+// the graph one node per line, children first
+void write_forest(ostream &os, const SolutionForest &forest) {
+    os << "numbers";
+    for (double number : forest.numbers) os << " " << number;
+    os << endl;
+
+    const char *ops = "+-*/";
+    for (uint32_t node = 0; node < forest.nodes.size(); node++) {
+        const ForestNode &n = forest.nodes[node];
+        os << "n" << node << " " << n.value << " (" << n.count << ")";
+        for (uint32_t e = n.first; e < n.last; e++) {
+            const ForestEdge &edge = forest.edges[e];
+            os << (e == n.first ? " = " : " | ") << "n" << edge.lhs << " " << ops[edge.op - PACKED_ADD] << " n" << edge.rhs;
+        }
+        os << endl;
+    }
+
+    os << "roots";
+    for (uint32_t root : forest.roots) os << " n" << root;
+    os << endl;
+}
+
+/********************************************************************
+SOLVER SESSIONS
+********************************************************************/
+
+// Keeps the subset tables of numbers that are revealed or swapped one at a
+// time, so each change only computes the subsets it affects.
+struct SolverSession {
+    SubsetTables tables;
+
+    SolverSession(int rules = RULES_FREE) : tables(vector<double>(), rules) {}
+
+    // only the subsets containing the new number are computed, in numeric
+    // order so their subsets are always done before them
+    long long add(double number) {
+        if (tables.numbers.size() >= 8 * sizeof(unsigned) - 1) throw TooManyNumbersException();
+
+        tables.numbers.push_back(number);
+        unsigned bit = 1u << (tables.numbers.size() - 1);
+        tables.values.resize(bit << 1);
+
+        long long explored = 0;
+        for (unsigned mask = bit; mask < (bit << 1); mask++) explored += compute_subset(tables, mask);
+        return explored;
+    }
+
+    // only the subsets containing the replaced number are invalidated
+    long long replace(int i, double number) {
+        if (i < 0 || i >= (int)tables.numbers.size()) throw NoSuchNumberException();
+        tables.numbers[i] = number;
+        unsigned bit = 1u << i;
+
+        long long explored = 0;
+        for (unsigned mask = bit; mask < tables.values.size(); mask++) {
+            if (mask & bit) explored += compute_subset(tables, mask);
+        }
+        return explored;
+    }
+
+    bool reachable(double target) const {
+        unsigned mask;
+        return tables.numbers.size() > 0 && closest(tables, target, mask) == target;
+    }
+
+    Best query(double target) const {
+        if (tables.numbers.empty()) return Best();
+        unsigned mask;
+        double value = closest(tables, target, mask);
+        return Best(reconstruct(tables, mask, value));
+    }
+};
+
+/********************************************************************
+TIME SLICED SEARCH
+********************************************************************/
+
+// The packed depth first search as a resumable state machine: the
+// recursion is an explicit stack, and step runs a bounded number of
+// expansions before handing the thread back. It visits the same nodes in
+// the same order as dfs_packed, so a search can be spread over many slices
+// interleaved with other work. Under Countdown rules the intermediate values
+// must be positive integers, and every expression has exactly the given
+// number of cards, all of them by default.
+struct DfsTask {
+    struct Frame {
+        Packed expr;
+        int open;
+        unsigned remaining;
+        int next; // the child to expand next: number indices, then operators
+    };
+
+    vector<double> numbers;
+    double target;
+    Scoring scoring;
+    int rules, cards;
+    PackedBest best;
+    long long explored;
+    vector<Frame> stack;
+
+    DfsTask(double target, vector<double> numbers, const Scoring &scoring = Scoring(), int rules = RULES_FREE, int cards = 0) : numbers(packed_numbers(numbers)), target(target), scoring(scoring), rules(rules), cards(cards > 0 ? cards : numbers.size()), explored(0) {
+        visit(PACKED_OPEN, 1, (1u << this->numbers.size()) - 1);
+    }
+
+    // leaves still to place
+    int spare(unsigned remaining) const {
+        return cards - (int)numbers.size() + __builtin_popcount(remaining);
+    }
+
+    bool done() const {
+        return stack.empty();
+    }
+
+    void visit(Packed expr, int open, unsigned remaining) {
+        explored++;
+
+        // no expression with a forbidden intermediate value is finished
+        double value;
+        if (rules == RULES_COUNTDOWN && !packed_countdown(expr, open, numbers, value)) return;
+
+        if (spare(remaining) == 0 && open == 0) {
+            // in this case we're on a leaf
+            PackedBest current(expr, numbers);
+            if (better(current, best, target)) best = current;
+
+            // lucky stop
+            if (scoring.done(best.value, target)) stack.clear();
+        } else if (open > 0 && open <= spare(remaining)) {
+            stack.push_back(Frame{expr, open, remaining, 0});
+        }
+    }
+
+    // runs at most steps expansions, true once the search is finished
+    bool step(long long steps) {
+        int n = numbers.size();
+        while (!stack.empty() && steps > 0) {
+            Frame &top = stack.back();
+
+            // skip used and duplicate numbers, and operators once they would
+            // leave more open nodes than leaves to place
+            while (top.next < n && (!(top.remaining & (1u << top.next)) || packed_duplicate(numbers, top.remaining, top.next))) top.next++;
+            if (top.next >= n && top.open >= spare(top.remaining)) top.next = n + 4;
+
+            if (top.next >= n + 4) {
+                stack.pop_back();
+                continue;
+            }
+
+            Frame parent = top;
+            top.next++;
+            steps--;
+            if (parent.next < n) {
+                visit(packed_fill_left(parent.expr, parent.next), parent.open - 1, parent.remaining & ~(1u << parent.next));
+            } else {
+                visit(packed_fill_left(parent.expr, PACKED_ADD + parent.next - n), parent.open + 1, parent.remaining);
+            }
+        }
+        return stack.empty();
+    }
+
+    Best result() const {
+        return unpack(best, numbers);
+    }
+};
+
+/********************************************************************
+BINARY PROTOCOL
+********************************************************************/
+
+// Requests and responses are compact little endian messages:
+//
+// request:  magic u16, version u8, kind u8, id u64, session u64, target i32,
+//           deadline u32 (microseconds after receipt, 0 for none),
+//           rules u8, priority u8, engine u8, count u8, numbers i32 * count
+// response: magic u16, version u8, kind u8, id u64, status u8,
+//           value f64, expr u64 (packed over the request numbers),
+//           elapsed u32 (microseconds)
+#define PROTOCOL_MAGIC 0x4e43
+#define PROTOCOL_VERSION 4
+#define MESSAGE_BYTES 64
+
+#define KIND_REQUEST 0
+#define KIND_RESPONSE 1
+
+#define STATUS_OK 0
+#define STATUS_EXPIRED 1
+#define STATUS_INVALID 2
+#define STATUS_SHED 3
+#define STATUS_OVER_BUDGET 4
+#define STATUS_PARTIAL 5 // the best found before the deadline
+
+#define ENGINE_TABLES 0
+#define ENGINE_DFS 1 // time sliced, free rules only
+
+#define PRIORITY_INTERACTIVE 0
+#define PRIORITY_BATCH 1
+
+struct Request {
+    uint64_t id;
+    uint64_t session; // 0 for none
+    int32_t target;
+    uint32_t deadline;
+    uint8_t rules, priority, engine;
+    vector<int32_t> numbers;
+
+    Request() : id(0), session(0), target(0), deadline(0), rules(RULES_FREE), priority(PRIORITY_INTERACTIVE), engine(ENGINE_TABLES) {}
+};
+
+struct Response {
+    uint64_t id;
+    uint8_t status;
+    double value;
+    Packed expr;
+    uint32_t elapsed;
+
+    Response() : id(0), status(STATUS_OK), value(0.0), expr(PACKED_OPEN), elapsed(0) {}
+};
+
+struct Writer {
+    uint8_t *data;
+    size_t size;
+
+    Writer(uint8_t *data) : data(data), size(0) {}
+
+    void put(uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) data[size++] = (uint8_t)(value >> (8 * i));
+    }
+};
+
+struct Reader {
+    const uint8_t *data;
+    size_t size, pos;
+
+    Reader(const uint8_t *data, size_t size) : data(data), size(size), pos(0) {}
+
+    uint64_t get(int bytes) {
+        if (pos + bytes > size) throw ProtocolException();
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++) value |= (uint64_t)data[pos++] << (8 * i);
+        return value;
+    }
+};
+
+void put_header(Writer &out, int kind, uint64_t id) {
+    out.put(PROTOCOL_MAGIC, 2);
+    out.put(PROTOCOL_VERSION, 1);
+    out.put(kind, 1);
+    out.put(id, 8);
+}
+
+uint64_t get_header(Reader &in, int kind) {
+    if (in.get(2) != PROTOCOL_MAGIC || in.get(1) != PROTOCOL_VERSION || in.get(1) != (uint64_t)kind) throw ProtocolException();
+    return in.get(8);
+}
+
+// returns the encoded size, out must hold MESSAGE_BYTES
+size_t encode(const Request &request, uint8_t *out) {
+    if (request.numbers.size() > PACKED_NUMBERS) throw TooManyNumbersException();
+
+    Writer writer(out);
+    put_header(writer, KIND_REQUEST, request.id);
+    writer.put(request.session, 8);
+    writer.put((uint32_t)request.target, 4);
+    writer.put(request.deadline, 4);
+    writer.put(request.rules, 1);
+    writer.put(request.priority, 1);
+    writer.put(request.engine, 1);
+    writer.put(request.numbers.size(), 1);
+    for (int32_t number : request.numbers) writer.put((uint32_t)number, 4);
+    return writer.size;
+}
+
+size_t encode(const Response &response, uint8_t *out) {
+    Writer writer(out);
+    put_header(writer, KIND_RESPONSE, response.id);
+    writer.put(response.status, 1);
+    writer.put(packed_key(response.value), 8);
+    writer.put(response.expr, 8);
+    writer.put(response.elapsed, 4);
+    return writer.size;
+}
+
+void decode(const uint8_t *data, size_t size, Request &request) {
+    Reader reader(data, size);
+    request.id = get_header(reader, KIND_REQUEST);
+    request.session = reader.get(8);
+    request.target = (int32_t)reader.get(4);
+    request.deadline = reader.get(4);
+    request.rules = reader.get(1);
+    request.priority = reader.get(1);
+    request.engine = reader.get(1);
+
+    size_t count = reader.get(1);
+    if (count > PACKED_NUMBERS) throw ProtocolException();
+    request.numbers.resize(count);
+    for (int32_t &number : request.numbers) number = (int32_t)reader.get(4);
+}
+
+void decode(const uint8_t *data, size_t size, Response &response) {
+    Reader reader(data, size);
+    response.id = get_header(reader, KIND_RESPONSE);
+    response.status = reader.get(1);
+    uint64_t value = reader.get(8);
+    memcpy(&response.value, &value, sizeof(value));
+    response.expr = reader.get(8);
+    response.elapsed = reader.get(4);
+}
+
+/********************************************************************
+SHARED MEMORY RING
+********************************************************************/
+
+// Co-located clients talk to a solver process through one POSIX shared
+// memory segment: a bounded multi-producer multi-consumer ring of request
+// slots, and a mailbox per client channel for the responses. Only atomics
+// synchronise, so a round trip to a warm solver makes no system calls.
+#define RING_SLOTS 1024
+#define RING_CHANNELS 64
+#define RING_MAGIC 0x676e6972756e6e63ULL
+
+#define CHANNEL_FREE 0
+#define CHANNEL_IDLE 1
+#define CHANNEL_WAITING 2
+#define CHANNEL_READY 3
+
+struct alignas(64) RingSlot {
+    atomic<uint64_t> sequence;
+    uint32_t channel, size;
+    uint8_t bytes[MESSAGE_BYTES];
+};
+
+struct alignas(64) Channel {
+    atomic<uint32_t> state;
+    uint32_t size;
+    uint8_t bytes[MESSAGE_BYTES];
+};
+
+struct Ring {
+    atomic<uint64_t> magic;
+    alignas(64) atomic<uint64_t> head;
+    alignas(64) atomic<uint64_t> tail;
+    RingSlot slots[RING_SLOTS];
+    Channel channels[RING_CHANNELS];
+};
+
+Ring* ring_map(const char *name, bool create) {
+    if (create) shm_unlink(name);
+    int fd = shm_open(name, create ? O_CREAT | O_RDWR : O_RDWR, 0600);
+    if (fd < 0) throw SharedMemoryException();
+    if (create && ftruncate(fd, sizeof(Ring)) != 0) {
+        close(fd);
+        throw SharedMemoryException();
+    }
+
+    void *memory = mmap(nullptr, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) throw SharedMemoryException();
+    return (Ring*)memory;
+}
+
+// the server creates the segment, a fresh one is all zeroes
+Ring* ring_create(const char *name) {
+    Ring *ring = ring_map(name, true);
+    for (uint64_t i = 0; i < RING_SLOTS; i++) ring->slots[i].sequence.store(i, memory_order_relaxed);
+    ring->magic.store(RING_MAGIC, memory_order_release);
+    return ring;
+}
+
+Ring* ring_open(const char *name) {
+    Ring *ring = ring_map(name, false);
+    if (ring->magic.load(memory_order_acquire) != RING_MAGIC) {
+        munmap(ring, sizeof(Ring));
+        throw SharedMemoryException();
+    }
+    return ring;
+}
+
+void ring_close(Ring *ring) {
+    munmap(ring, sizeof(Ring));
+}
+
+// bounded queue after Vyukov: a slot's sequence says whose turn it is
+bool ring_push(Ring *ring, uint32_t channel, const uint8_t *bytes, size_t size) {
+    uint64_t pos = ring->tail.load(memory_order_relaxed);
+    while (true) {
+        RingSlot &slot = ring->slots[pos % RING_SLOTS];
+        int64_t diff = (int64_t)slot.sequence.load(memory_order_acquire) - (int64_t)pos;
+        if (diff == 0) {
+            if (ring->tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                slot.channel = channel;
+                slot.size = size;
+                memcpy(slot.bytes, bytes, size);
+                slot.sequence.store(pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = ring->tail.load(memory_order_relaxed);
+        }
+    }
+}
+
+bool ring_pop(Ring *ring, uint32_t &channel, uint8_t *bytes, size_t &size) {
+    uint64_t pos = ring->head.load(memory_order_relaxed);
+    while (true) {
+        RingSlot &slot = ring->slots[pos % RING_SLOTS];
+        int64_t diff = (int64_t)slot.sequence.load(memory_order_acquire) - (int64_t)(pos + 1);
+        if (diff == 0) {
+            if (ring->head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                channel = slot.channel;
+                // any client can write the slot, an oversized message decodes as empty and invalid
+                size = slot.size <= MESSAGE_BYTES ? slot.size : 0;
+                memcpy(bytes, slot.bytes, size);
+                slot.sequence.store(pos + RING_SLOTS, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // empty
+        } else {
+            pos = ring->head.load(memory_order_relaxed);
+        }
+    }
+}
+
+// a channel is owned by one client thread until released, -1 if none free
+int channel_acquire(Ring *ring) {
+    for (int i = 0; i < RING_CHANNELS; i++) {
+        uint32_t expected = CHANNEL_FREE;
+        if (ring->channels[i].state.compare_exchange_strong(expected, CHANNEL_IDLE)) return i;
+    }
+    return -1;
+}
+
+void channel_release(Ring *ring, int channel) {
+    ring->channels[channel].state.store(CHANNEL_FREE, memory_order_release);
+}
+
+void channel_respond(Ring *ring, uint32_t channel, const uint8_t *bytes, size_t size) {
+    if (channel >= RING_CHANNELS) return;
+    Channel &mailbox = ring->channels[channel];
+    mailbox.size = size;
+    memcpy(mailbox.bytes, bytes, size);
+    mailbox.state.store(CHANNEL_READY, memory_order_release);
+}
+
+// spin briefly, then yield, then sleep, so idle waiting stays cheap
+void backoff(int &idle) {
+    if (++idle < 1000) return;
+    if (idle < 2000) this_thread::yield();
+    else this_thread::sleep_for(chrono::microseconds(50));
+}
+
+// seconds a client waits beyond its request's own deadline
+#define CHANNEL_TIMEOUT 30
+
+// a full round trip on an owned channel; throws if the server does not
+// answer in time, and the channel is then left taken, as a late response
+// may still land in it
+Response channel_request(Ring *ring, int channel, const Request &request) {
+    uint8_t bytes[MESSAGE_BYTES];
+    size_t size = encode(request, bytes);
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::seconds(CHANNEL_TIMEOUT) + chrono::microseconds(request.deadline);
+
+    Channel &mailbox = ring->channels[channel];
+    mailbox.state.store(CHANNEL_WAITING, memory_order_relaxed);
+    for (int idle = 0; !ring_push(ring, channel, bytes, size);) {
+        backoff(idle);
+        if (chrono::steady_clock::now() > deadline) throw DeadlineExceededException();
+    }
+    for (int idle = 0; mailbox.state.load(memory_order_acquire) != CHANNEL_READY;) {
+        backoff(idle);
+        if (chrono::steady_clock::now() > deadline) throw DeadlineExceededException();
+    }
+
+    Response response;
+    if (mailbox.size > MESSAGE_BYTES) throw ProtocolException();
+    decode(mailbox.bytes, mailbox.size, response);
+    mailbox.state.store(CHANNEL_IDLE, memory_order_relaxed);
+    return response;
+}
+
+/********************************************************************
+METRICS EXPORT
+********************************************************************/
+
+// Aggregates of the Metrics of every request a server solves. Each worker
+// thread owns its counters, on their own cache lines, and is their only
+// writer; a scrape merges them and renders the Prometheus text format.
+#define LATENCY_BUCKETS 20 // upper bounds 1us, 2us, 4us, ... about 0.5s, then +Inf
+
+struct alignas(64) WorkerCounters {
+    atomic<uint64_t> requests, explored, cache_hits, expired, invalid, shed, over_budget;
+    atomic<uint64_t> latency_sum; // microseconds
+    atomic<uint64_t> latency[LATENCY_BUCKETS + 1];
+
+    WorkerCounters() : requests(0), explored(0), cache_hits(0), expired(0), invalid(0), shed(0), over_budget(0), latency_sum(0) {
+        for (atomic<uint64_t> &bucket : latency) bucket.store(0, memory_order_relaxed);
+    }
+};
+
+// single writer, so a plain load and store instead of a locked add
+inline void bump(atomic<uint64_t> &counter, uint64_t amount = 1) {
+    counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+void record(WorkerCounters &counters, const Response &response, long long explored, bool hit = false) {
+    bump(counters.requests);
+    bump(counters.explored, explored);
+    if (hit) bump(counters.cache_hits);
+    if (response.status == STATUS_EXPIRED) bump(counters.expired);
+    if (response.status == STATUS_INVALID) bump(counters.invalid);
+    if (response.status == STATUS_SHED) bump(counters.shed);
+    if (response.status == STATUS_OVER_BUDGET) bump(counters.over_budget);
+
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS && response.elapsed > (1u << bucket)) bucket++;
+    bump(counters.latency[bucket]);
+    bump(counters.latency_sum, response.elapsed);
+}
+
+struct MetricsRegistry {
+    mutex lock;
+    vector<unique_ptr<WorkerCounters>> workers;
+    function<long long()> queue_depth;
+
+    MetricsRegistry() : queue_depth([]() { return 0LL; }) {}
+
+    WorkerCounters* add_worker() {
+        lock_guard<mutex> guard(lock);
+        workers.emplace_back(new WorkerCounters());
+        return workers.back().get();
+    }
+};
+
+string scrape(MetricsRegistry &registry) {
+    uint64_t requests = 0, explored = 0, cache_hits = 0, expired = 0, invalid = 0, shed = 0, over_budget = 0, latency_sum = 0;
+    uint64_t latency[LATENCY_BUCKETS + 1] = {};
+
+    {
+        lock_guard<mutex> guard(registry.lock);
+        for (unique_ptr<WorkerCounters> &counters : registry.workers) {
+            requests += counters->requests.load(memory_order_relaxed);
+            explored += counters->explored.load(memory_order_relaxed);
+            cache_hits += counters->cache_hits.load(memory_order_relaxed);
+            expired += counters->expired.load(memory_order_relaxed);
+            invalid += counters->invalid.load(memory_order_relaxed);
+            shed += counters->shed.load(memory_order_relaxed);
+            over_budget += counters->over_budget.load(memory_order_relaxed);
+            latency_sum += counters->latency_sum.load(memory_order_relaxed);
+            for (int i = 0; i <= LATENCY_BUCKETS; i++) latency[i] += counters->latency[i].load(memory_order_relaxed);
+        }
+    }
+
+    ostringstream os;
+    os << "# TYPE calcnum_requests_total counter\n" << "calcnum_requests_total " << requests << "\n";
+    os << "# TYPE calcnum_expired_total counter\n" << "calcnum_expired_total " << expired << "\n";
+    os << "# TYPE calcnum_invalid_total counter\n" << "calcnum_invalid_total " << invalid << "\n";
+    os << "# TYPE calcnum_shed_total counter\n" << "calcnum_shed_total " << shed << "\n";
+    os << "# TYPE calcnum_over_budget_total counter\n" << "calcnum_over_budget_total " << over_budget << "\n";
+    os << "# TYPE calcnum_explored_nodes_total counter\n" << "calcnum_explored_nodes_total " << explored << "\n";
+    os << "# TYPE calcnum_cache_hits_total counter\n" << "calcnum_cache_hits_total " << cache_hits << "\n";
+    os << "# TYPE calcnum_queue_depth gauge\n" << "calcnum_queue_depth " << registry.queue_depth() << "\n";
+
+    os << "# TYPE calcnum_request_latency_seconds histogram\n";
+    uint64_t cumulative = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        cumulative += latency[i];
+        os << "calcnum_request_latency_seconds_bucket{le=\"" << (double)(1u << i) / 1e6 << "\"} " << cumulative << "\n";
+    }
+    cumulative += latency[LATENCY_BUCKETS];
+    os << "calcnum_request_latency_seconds_bucket{le=\"+Inf\"} " << cumulative << "\n";
+    os << "calcnum_request_latency_seconds_sum " << (double)latency_sum / 1e6 << "\n";
+    os << "calcnum_request_latency_seconds_count " << cumulative << "\n";
+    return os.str();
+}
+
+// rewrites the file every interval, renaming so readers never see half
+void export_file(MetricsRegistry &registry, const string &path, const atomic<bool> &stop) {
+    while (!stop) {
+        string tmp = path + ".tmp";
+        {
+            ofstream out(tmp);
+            out << scrape(registry);
+        }
+        rename(tmp.c_str(), path.c_str());
+
+        for (int i = 0; i < 10 && !stop; i++) this_thread::sleep_for(chrono::milliseconds(100));
+    }
+}
+
+// every connection to the socket receives one scrape
+void export_socket(MetricsRegistry &registry, const string &path, const atomic<bool> &stop) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(path.c_str());
+    if (fd < 0 || ::bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0) {
+        if (fd >= 0) close(fd);
+        cerr << "cannot listen on " << path << endl;
+        return;
+    }
+
+    while (!stop) {
+        pollfd ready = {fd, POLLIN, 0};
+        if (poll(&ready, 1, 100) <= 0) continue;
+
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0) continue;
+        string text = scrape(registry);
+        for (size_t sent = 0; sent < text.size();) {
+            ssize_t n = write(client, text.data() + sent, text.size() - sent);
+            if (n <= 0) break;
+            sent += n;
+        }
+        close(client);
+    }
+
+    close(fd);
+    unlink(path.c_str());
+}
+
+/********************************************************************
+SCHEDULER
+********************************************************************/
+
+// Sits between the ring and the solver workers. Requests wait in one of two
+// bounded lanes, interactive before batch, and within a lane the job with
+// the lowest expected cost runs first. A request finding its lane full is
+// shed straight away instead of queueing behind work it cannot wait for.
+
+// expected microseconds to build the tables for n distinct numbers,
+// measured on random Countdown selections
+const double COST_FREE[PACKED_NUMBERS + 1] = {0., 0.5, 0.5, 5., 125., 3850., 133000., 5400000., 200000000.};
+const double COST_COUNTDOWN[PACKED_NUMBERS + 1] = {0., 0.5, 1., 3., 32., 480., 5500., 98000., 1500000.};
+
+// and for a depth first search through the whole space
+const double COST_DFS[PACKED_NUMBERS + 1] = {0., 1., 3., 27., 1000., 59000., 3250000., 300000000., 30000000000.};
+
+double estimate_cost(const Request &request) {
+    size_t n = min<size_t>(request.numbers.size(), PACKED_NUMBERS);
+    if (n == 0) return 0.;
+
+    // equal numbers make for fewer distinct subsets, and so fewer values
+    vector<int32_t> numbers(request.numbers);
+    sort(numbers.begin(), numbers.end());
+    double multisets = 1.;
+    for (size_t i = 0, run = 1; i < n; i++, run++) {
+        if (i + 1 == n || numbers[i + 1] != numbers[i]) {
+            multisets *= run + 1;
+            run = 0;
+        }
+    }
+
+    const double *cost = request.engine == ENGINE_DFS ? COST_DFS : request.rules == RULES_COUNTDOWN ? COST_COUNTDOWN : COST_FREE;
+    return cost[n] * (multisets - 1.) / ((1 << n) - 1);
+}
+
+struct Job {
+    Request request;
+    uint32_t channel;
+    double cost;
+    uint64_t order;
+    chrono::steady_clock::time_point received;
+};
+
+// the queue pops the largest, so the cheapest and then oldest job is largest
+bool operator<(const Job &lhs, const Job &rhs) {
+    if (lhs.cost != rhs.cost) return lhs.cost > rhs.cost;
+    return lhs.order > rhs.order;
+}
+
+struct Scheduler {
+    mutex lock;
+    condition_variable ready;
+    priority_queue<Job> lanes[2];
+    size_t capacity[2];
+    uint64_t order;
+
+    Scheduler(size_t interactive, size_t batch) : order(0) {
+        capacity[PRIORITY_INTERACTIVE] = interactive;
+        capacity[PRIORITY_BATCH] = batch;
+    }
+
+    // false if the lane is full and the job is shed
+    bool admit(Job job) {
+        int lane = job.request.priority == PRIORITY_BATCH ? PRIORITY_BATCH : PRIORITY_INTERACTIVE;
+        {
+            lock_guard<mutex> guard(lock);
+            if (lanes[lane].size() >= capacity[lane]) return false;
+            job.order = order++;
+            lanes[lane].push(job);
+        }
+        ready.notify_one();
+        return true;
+    }
+
+    // blocks until there is a job, false once stopped
+    bool take(Job &job, const atomic<bool> &stop) {
+        unique_lock<mutex> guard(lock);
+        while (lanes[PRIORITY_INTERACTIVE].empty() && lanes[PRIORITY_BATCH].empty()) {
+            if (stop) return false;
+            ready.wait_for(guard, chrono::milliseconds(100));
+        }
+        return pop(job);
+    }
+
+    bool try_take(Job &job) {
+        lock_guard<mutex> guard(lock);
+        return pop(job);
+    }
+
+    // the lock must be held
+    bool pop(Job &job) {
+        if (lanes[PRIORITY_INTERACTIVE].empty() && lanes[PRIORITY_BATCH].empty()) return false;
+        priority_queue<Job> &lane = lanes[lanes[PRIORITY_INTERACTIVE].empty() ? PRIORITY_BATCH : PRIORITY_INTERACTIVE];
+        job = lane.top();
+        lane.pop();
+        return true;
+    }
+
+    size_t depth() {
+        lock_guard<mutex> guard(lock);
+        return lanes[PRIORITY_INTERACTIVE].size() + lanes[PRIORITY_BATCH].size();
+    }
+};
+
+/********************************************************************
+TABLE CACHE
+********************************************************************/
+
+// Concurrent requests for the same multiset of numbers under the same rules
+// share one build of the subset tables (single flight): the first builds,
+// the others wait on its future. Built tables stay for later requests until
+// they are the least recently used beyond the capacity.
+typedef pair<int, vector<int32_t>> TableKey;
+
+TableKey table_key(const Request &request) {
+    TableKey key(request.rules, request.numbers);
+    sort(key.second.begin(), key.second.end());
+    return key;
+}
+
+// the position in the request of every number of the sorted key
+vector<int> key_positions(const Request &request) {
+    vector<int> positions(request.numbers.size());
+    for (size_t i = 0; i < positions.size(); i++) positions[i] = i;
+    stable_sort(positions.begin(), positions.end(), [&request](int lhs, int rhs) { return request.numbers[lhs] < request.numbers[rhs]; });
+    return positions;
+}
+
+// rewrite the number codes of an expression
+Packed remap(Packed expr, const vector<int> &positions) {
+    Packed result = PACKED_OPEN;
+    for (int i = 0; i < packed_length(expr); i++) {
+        int code = packed_code(expr, i);
+        result = packed_fill_left(result, packed_is_op(code) ? code : positions[code]);
+    }
+    return result;
+}
+
+struct TableCache {
+    typedef shared_future<shared_ptr<const SubsetTables>> Flight;
+
+    struct Entry {
+        Flight flight;
+        list<TableKey>::iterator recent;
+        uint64_t build; // tells a flight from a later one for the same key
+    };
+
+    mutex lock;
+    size_t capacity;
+    uint64_t builds;
+    list<TableKey> recent; // most recently used first
+    map<TableKey, Entry> flights;
+
+    TableCache(size_t capacity) : capacity(capacity), builds(0) {}
+
+    // tables for the key, built under the budget by the first requester;
+    // waiting gives up at the deadline, the build carries on regardless
+    shared_ptr<const SubsetTables> acquire(const TableKey &key, long long &explored, Budget *budget, chrono::steady_clock::time_point deadline, bool &hit) {
+        unique_lock<mutex> guard(lock);
+        auto it = flights.find(key);
+        if (it != flights.end()) {
+            hit = true;
+            recent.splice(recent.begin(), recent, it->second.recent);
+            Flight flight = it->second.flight;
+            guard.unlock();
+
+            if (deadline.time_since_epoch().count() > 0 && flight.wait_until(deadline) == future_status::timeout) throw DeadlineExceededException();
+            return flight.get();
+        }
+
+        hit = false;
+        promise<shared_ptr<const SubsetTables>> result;
+        uint64_t build = ++builds;
+        recent.push_front(key);
+        flights[key] = Entry{result.get_future().share(), recent.begin(), build};
+        guard.unlock();
+
+        try {
+            vector<double> numbers(key.second.begin(), key.second.end());
+            shared_ptr<const SubsetTables> tables = make_shared<SubsetTables>(build_tables(numbers, explored, true, key.first, budget));
+            result.set_value(tables);
+            evict();
+            return tables;
+        } catch (...) {
+            result.set_exception(current_exception());
+            forget(key, build);
+            throw;
+        }
+    }
+
+    // drops a failed build, unless it was already replaced by a newer one
+    void forget(const TableKey &key, uint64_t build) {
+        lock_guard<mutex> guard(lock);
+        auto it = flights.find(key);
+        if (it == flights.end() || it->second.build != build) return;
+        recent.erase(it->second.recent);
+        flights.erase(it);
+    }
+
+    // least recently used first, skipping builds still in flight, which
+    // would otherwise be started again by their next requester
+    void evict() {
+        lock_guard<mutex> guard(lock);
+        for (auto it = recent.end(); flights.size() > capacity && it != recent.begin();) {
+            --it;
+            auto entry = flights.find(*it);
+            if (entry->second.flight.wait_for(chrono::seconds(0)) != future_status::ready) continue;
+            flights.erase(entry);
+            it = recent.erase(it);
+        }
+    }
+};
+
+/********************************************************************
+TABLE SNAPSHOTS
+********************************************************************/
+
+// A snapshot holds the subset tables of many number sets in one file that
+// is mapped read only and queried in place, without deserializing. All
+// fields are little endian and 8 byte aligned:
+//
+// header:    magic u64, version u32, count u32, size u64, checksum u64
+//            (FNV-1a of everything after the header)
+// directory: count * (rules u32, n u32, numbers i32 * 8, offsets u64)
+// per set:   offsets u64 * (2^n + 1), where every subset's values start,
+//            then data f64 * offsets[2^n], the sorted values
+//
+// Tables must be built from sorted numbers, as the table cache does.
+#define SNAPSHOT_MAGIC 0x50414e534d554e43ULL
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADER 32
+#define SNAPSHOT_ENTRY 48
+
+// the values of one subset inside a mapping
+struct ValueSpan {
+    const double *first, *last;
+
+    const double* begin() const { return first; }
+    const double* end() const { return last; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+    double back() const { return *(last - 1); }
+};
+
+struct MappedValues {
+    const uint64_t *offsets;
+    const double *data;
+    size_t count; // 2^n
+
+    ValueSpan operator[](size_t mask) const {
+        return ValueSpan{data + offsets[mask], data + offsets[mask + 1]};
+    }
+
+    size_t size() const {
+        return count;
+    }
+};
+
+// answers the same queries as SubsetTables
+struct TableView {
+    vector<double> numbers;
+    int rules;
+    MappedValues values;
+};
+
+uint64_t fnv1a(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+inline void put_at(vector<uint8_t> &out, size_t pos, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) out[pos + i] = (uint8_t)(value >> (8 * i));
+}
+
+inline uint64_t get_at(const uint8_t *data, size_t pos, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) value |= (uint64_t)data[pos + i] << (8 * i);
+    return value;
+}
+
+// written aside, synced and renamed, so a reader never maps a partial
+// file, even after a crash; false on failure
+bool write_file(const string &path, const vector<uint8_t> &bytes) {
+    string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    for (size_t written = 0; written < bytes.size();) {
+        ssize_t n = write(fd, bytes.data() + written, bytes.size() - written);
+        if (n <= 0) {
+            close(fd);
+            return false;
+        }
+        written += n;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// the whole file mapped read only, nullptr on failure
+const uint8_t* map_file(const string &path, size_t &size) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    off_t length = lseek(fd, 0, SEEK_END);
+    void *memory = length > 0 ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (memory == MAP_FAILED) return nullptr;
+    size = length;
+    return (const uint8_t*)memory;
+}
+
+vector<uint8_t> serialize(const vector<shared_ptr<const SubsetTables>> &tables) {
+    size_t size = SNAPSHOT_HEADER + SNAPSHOT_ENTRY * tables.size();
+    for (const shared_ptr<const SubsetTables> &set : tables) {
+        if (set->numbers.size() > PACKED_NUMBERS) throw TooManyNumbersException();
+        size += 8 * (set->values.size() + 1);
+        for (const vector<double> &values : set->values) size += 8 * values.size();
+    }
+
+    vector<uint8_t> out(size, 0);
+    put_at(out, 0, SNAPSHOT_MAGIC, 8);
+    put_at(out, 8, SNAPSHOT_VERSION, 4);
+    put_at(out, 12, tables.size(), 4);
+    put_at(out, 16, size, 8);
+
+    size_t pos = SNAPSHOT_HEADER + SNAPSHOT_ENTRY * tables.size();
+    for (size_t t = 0; t < tables.size(); t++) {
+        const SubsetTables &set = *tables[t];
+        size_t entry = SNAPSHOT_HEADER + SNAPSHOT_ENTRY * t;
+        put_at(out, entry, set.rules, 4);
+        put_at(out, entry + 4, set.numbers.size(), 4);
+        for (size_t i = 0; i < set.numbers.size(); i++) put_at(out, entry + 8 + 4 * i, (uint32_t)(int32_t)set.numbers[i], 4);
+
+        size_t offsets = pos, data = pos + 8 * (set.values.size() + 1);
+        put_at(out, entry + 40, offsets, 8);
+
+        uint64_t start = 0;
+        for (size_t mask = 0; mask < set.values.size(); mask++) {
+            put_at(out, offsets + 8 * mask, start, 8);
+            for (size_t i = 0; i < set.values[mask].size(); i++) put_at(out, data + 8 * (start + i), packed_key(set.values[mask][i]), 8);
+            start += set.values[mask].size();
+        }
+        put_at(out, offsets + 8 * set.values.size(), start, 8);
+        pos = data + 8 * start;
+    }
+
+    put_at(out, 24, fnv1a(out.data() + SNAPSHOT_HEADER, size - SNAPSHOT_HEADER), 8);
+    return out;
+}
+
+struct Snapshot {
+    const uint8_t *memory;
+    size_t size;
+    bool mapped;
+    map<TableKey, TableView> views;
+
+    Snapshot() : memory(nullptr), size(0), mapped(false) {}
+    ~Snapshot() {
+        if (mapped) munmap((void*)memory, size);
+    }
+
+    const TableView* find(const TableKey &key) const {
+        auto it = views.find(key);
+        return it == views.end() ? nullptr : &it->second;
+    }
+};
+
+// the view of the t-th set of a snapshot in memory, throws if malformed
+TableView read_view(const uint8_t *memory, size_t size, size_t t) {
+    size_t entry = SNAPSHOT_HEADER + SNAPSHOT_ENTRY * t;
+    TableView view;
+    view.rules = get_at(memory, entry, 4);
+    size_t n = get_at(memory, entry + 4, 4);
+    if (n == 0 || n > PACKED_NUMBERS) throw SnapshotException();
+    for (size_t i = 0; i < n; i++) view.numbers.push_back((int32_t)get_at(memory, entry + 8 + 4 * i, 4));
+
+    size_t offsets = get_at(memory, entry + 40, 8);
+    view.values.count = (size_t)1 << n;
+    if (offsets % 8 != 0 || offsets + 8 * (view.values.count + 1) > size) throw SnapshotException();
+    view.values.offsets = (const uint64_t*)(memory + offsets);
+    view.values.data = (const double*)(memory + offsets + 8 * (view.values.count + 1));
+    if ((const uint8_t*)(view.values.data + view.values.offsets[view.values.count]) > memory + size) throw SnapshotException();
+    return view;
+}
+
+// reads the directory of a snapshot in memory, the values stay where they
+// are; throws if the snapshot is malformed
+void index_snapshot(Snapshot &snapshot, bool verify) {
+    const uint8_t *memory = snapshot.memory;
+    size_t size = snapshot.size;
+    if (size < SNAPSHOT_HEADER || get_at(memory, 0, 8) != SNAPSHOT_MAGIC || get_at(memory, 8, 4) != SNAPSHOT_VERSION) throw SnapshotException();
+    if (get_at(memory, 16, 8) != size) throw SnapshotException();
+    if (verify && get_at(memory, 24, 8) != fnv1a(memory + SNAPSHOT_HEADER, size - SNAPSHOT_HEADER)) throw SnapshotException();
+
+    size_t count = get_at(memory, 12, 4);
+    if (SNAPSHOT_HEADER + SNAPSHOT_ENTRY * count > size) throw SnapshotException();
+
+    for (size_t t = 0; t < count; t++) {
+        TableView view = read_view(memory, size, t);
+        TableKey key(view.rules, vector<int32_t>(view.numbers.begin(), view.numbers.end()));
+        snapshot.views[key] = view;
+    }
+}
+
+shared_ptr<Snapshot> open_snapshot(const string &path, bool verify = true) {
+    shared_ptr<Snapshot> snapshot = make_shared<Snapshot>();
+    snapshot->memory = map_file(path, snapshot->size);
+    if (!snapshot->memory) throw SnapshotException();
+    snapshot->mapped = true;
+    index_snapshot(*snapshot, verify);
+    return snapshot;
+}
+
+void write_snapshot(const string &path, const vector<shared_ptr<const SubsetTables>> &tables) {
+    if (!write_file(path, serialize(tables))) throw SnapshotException();
+}
+
+/********************************************************************
+SHARED TABLE CACHE
+********************************************************************/
+
+// Solver processes on one host share subset tables and solved results
+// through a POSIX shared memory segment, so every table is built once per
+// host rather than once per process. Tables are one set snapshots in an
+// append only arena, both kinds are found by open addressing over fixed
+// slots. A writer claims an empty or dead slot, writes the key, marks it
+// building and then ready; readers only load states, and wait on a building
+// slot while its owner is alive.
+#define SHARED_TABLE_SLOTS 4096
+#define SHARED_RESULT_SLOTS 65536
+#define SHARED_PROBES 64
+#define SHARED_CLAIM_WAIT 3000 // backoff steps, some 50 ms
+#define SHARED_MAGIC 0x6572616873756e63ULL
+
+#define SLOT_EMPTY 0
+#define SLOT_CLAIMED 1 // key being written
+#define SLOT_BUILDING 2
+#define SLOT_READY 3
+#define SLOT_DEAD 4 // build failed or builder died, free for reuse
+
+struct SharedSlot {
+    atomic<uint32_t> state;
+    int32_t owner; // process building the tables
+    int32_t rules, count, target;
+    int32_t numbers[PACKED_NUMBERS];
+    uint64_t offset, size; // tables in the arena
+    double value; // results
+    Packed expr;
+};
+
+struct SharedCache {
+    atomic<uint64_t> magic;
+    uint64_t size; // of the whole segment
+    alignas(64) atomic<uint64_t> used; // bytes of the arena
+    SharedSlot tables[SHARED_TABLE_SLOTS];
+    SharedSlot results[SHARED_RESULT_SLOTS];
+
+    uint8_t* arena() {
+        return (uint8_t*)(this + 1);
+    }
+
+    uint64_t arena_size() const {
+        return size - sizeof(SharedCache);
+    }
+};
+
+// the first process creates the segment, the others wait until it is ready
+SharedCache* shared_open(const char *name, size_t arena) {
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    bool created = fd >= 0;
+    if (!created) fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0) throw SharedMemoryException();
+
+    size_t size = sizeof(SharedCache) + arena;
+    if (created && ftruncate(fd, size) != 0) {
+        close(fd);
+        throw SharedMemoryException();
+    }
+    for (int idle = 0; !created; backoff(idle)) {
+        off_t existing = lseek(fd, 0, SEEK_END);
+        if (existing >= (off_t)sizeof(SharedCache)) {
+            size = existing;
+            break;
+        }
+        if (idle > 100000) {
+            close(fd);
+            throw SharedMemoryException();
+        }
+    }
+
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) throw SharedMemoryException();
+
+    SharedCache *cache = (SharedCache*)memory;
+    if (created) {
+        cache->size = size;
+        cache->magic.store(SHARED_MAGIC, memory_order_release);
+    }
+    for (int idle = 0; cache->magic.load(memory_order_acquire) != SHARED_MAGIC; backoff(idle)) {
+        if (idle > 100000) {
+            munmap(memory, size);
+            throw SharedMemoryException();
+        }
+    }
+    return cache;
+}
+
+void shared_close(SharedCache *cache) {
+    munmap(cache, cache->size);
+}
+
+uint64_t shared_hash(const TableKey &key, int32_t target) {
+    vector<int32_t> words = {key.first, (int32_t)key.second.size(), target};
+    words.insert(words.end(), key.second.begin(), key.second.end());
+    return fnv1a((const uint8_t*)words.data(), 4 * words.size());
+}
+
+bool shared_matches(const SharedSlot &slot, const TableKey &key, int32_t target) {
+    return slot.rules == key.first && slot.target == target && slot.count == (int32_t)key.second.size() && equal(key.second.begin(), key.second.end(), slot.numbers);
+}
+
+// the published slot of the key; or with claim, a free slot now owned by
+// the caller with the key written; nullptr when the probes run out. Free
+// slots are empty ones and dead ones, reused. A slot claimed elsewhere is
+// waited on until its key is written, so that two processes asking for the
+// same key at once share one slot; one whose claimer died is passed over.
+SharedSlot* shared_slot(SharedSlot *slots, size_t count, const TableKey &key, int32_t target, bool claim, bool &claimed) {
+    claimed = false;
+    size_t start = shared_hash(key, target) % count;
+    for (size_t attempt = 0; attempt < SHARED_PROBES; attempt++) {
+        SharedSlot *free = nullptr;
+        uint32_t free_state = SLOT_EMPTY;
+        for (size_t i = 0; i < SHARED_PROBES; i++) {
+            SharedSlot &slot = slots[(start + i) % count];
+            uint32_t state = slot.state.load(memory_order_acquire);
+            for (int idle = 0; state == SLOT_CLAIMED && idle < SHARED_CLAIM_WAIT; backoff(idle)) state = slot.state.load(memory_order_acquire);
+
+            if (state == SLOT_EMPTY || state == SLOT_DEAD) {
+                if (!free) {
+                    free = &slot;
+                    free_state = state;
+                }
+                if (state == SLOT_EMPTY) break; // the key is not further on
+            } else if (state != SLOT_CLAIMED && shared_matches(slot, key, target)) {
+                return &slot;
+            }
+        }
+        if (!claim || !free) return nullptr;
+
+        if (free->state.compare_exchange_strong(free_state, SLOT_CLAIMED, memory_order_acquire)) {
+            free->owner = getpid();
+            free->rules = key.first;
+            free->count = key.second.size();
+            free->target = target;
+            copy(key.second.begin(), key.second.end(), free->numbers);
+            claimed = true;
+            return free;
+        }
+        // another process took the slot first, perhaps for this key
+    }
+    return nullptr;
+}
+
+bool shared_result(SharedCache *cache, const TableKey &key, int32_t target, Response &response) {
+    bool claimed;
+    SharedSlot *slot = shared_slot(cache->results, SHARED_RESULT_SLOTS, key, target, false, claimed);
+    if (!slot || slot->state.load(memory_order_acquire) != SLOT_READY) return false;
+    response.value = slot->value;
+    response.expr = slot->expr;
+    return true;
+}
+
+void shared_store(SharedCache *cache, const TableKey &key, int32_t target, const Response &response) {
+    bool claimed;
+    SharedSlot *slot = shared_slot(cache->results, SHARED_RESULT_SLOTS, key, target, true, claimed);
+    if (!claimed) return;
+    slot->value = response.value;
+    slot->expr = response.expr;
+    slot->state.store(SLOT_READY, memory_order_release);
+}
+
+// The view of the shared tables of the key, built here if this process
+// claims them first. Returns false if they cannot be shared: the slots or
+// the arena are full, or the builder died; then built holds the tables if
+// this process built them anyway.
+bool shared_tables(SharedCache *cache, const TableKey &key, long long &explored, Budget *budget, chrono::steady_clock::time_point deadline, TableView &view, shared_ptr<const SubsetTables> &built, bool &hit) {
+    bool claimed;
+    SharedSlot *slot = shared_slot(cache->tables, SHARED_TABLE_SLOTS, key, 0, true, claimed);
+    if (!slot) return false;
+
+    if (claimed) {
+        hit = false;
+        slot->state.store(SLOT_BUILDING, memory_order_release);
+        try {
+            built = make_shared<SubsetTables>(build_tables(vector<double>(key.second.begin(), key.second.end()), explored, true, key.first, budget));
+        } catch (...) {
+            slot->state.store(SLOT_DEAD, memory_order_release);
+            throw;
+        }
+
+        // the arena only grows when the tables fit
+        vector<uint8_t> bytes = serialize({built});
+        uint64_t size = (bytes.size() + 7) & ~7ULL;
+        uint64_t offset = cache->used.load(memory_order_relaxed);
+        do {
+            if (offset + size > cache->arena_size()) {
+                slot->state.store(SLOT_DEAD, memory_order_release);
+                return false;
+            }
+        } while (!cache->used.compare_exchange_weak(offset, offset + size, memory_order_relaxed));
+        memcpy(cache->arena() + offset, bytes.data(), bytes.size());
+        slot->offset = offset;
+        slot->size = bytes.size();
+        slot->state.store(SLOT_READY, memory_order_release);
+    } else {
+        hit = true;
+        uint32_t state;
+        for (int idle = 0; (state = slot->state.load(memory_order_acquire)) == SLOT_BUILDING; backoff(idle)) {
+            if (deadline.time_since_epoch().count() > 0 && chrono::steady_clock::now() > deadline) throw DeadlineExceededException();
+            if (idle > 2000 && kill(slot->owner, 0) != 0 && errno == ESRCH) {
+                // free the slot of the dead builder for reuse
+                slot->state.compare_exchange_strong(state, SLOT_DEAD, memory_order_release);
+                return false;
+            }
+        }
+        // a dead slot may have been reused for another key meanwhile
+        if (state != SLOT_READY || !shared_matches(*slot, key, 0)) return false;
+    }
+
+    view = read_view(cache->arena() + slot->offset, slot->size, 0);
+    return true;
+}
+
+/********************************************************************
+RESULT STORE
+********************************************************************/
+
+// Solved results outlive the process in an append only log. Each record
+// is a payload size u32 and FNV-1a checksum u64, then the payload: rules u8,
+// count u8, target i32, the sorted numbers i32, value f64 and packed
+// expression u64. An in memory hash index from key to record offset is
+// rebuilt by scanning the log at startup; a torn or corrupt tail left by a
+// crash ends the scan and is cut off. Appends are synced once a second and
+// the log is compacted aside, then renamed over, once most of it is dead.
+// Appends go at an offset only this process knows, so the log is locked to
+// one process; a second server given the same path fails to open it.
+#define STORE_RECORD_HEADER 12
+#define STORE_RECORD_MAX (STORE_RECORD_HEADER + 6 + 4 * PACKED_NUMBERS + 16)
+#define STORE_COMPACT_BYTES (1 << 20)
+
+// canonical bytes of a key and a target, the record payload starts with them
+string store_key(const TableKey &key, int32_t target) {
+    uint8_t bytes[STORE_RECORD_MAX];
+    Writer writer(bytes);
+    writer.put(key.first, 1);
+    writer.put(key.second.size(), 1);
+    writer.put((uint32_t)target, 4);
+    for (int32_t number : key.second) writer.put((uint32_t)number, 4);
+    return string((const char*)bytes, writer.size);
+}
+
+// the size of the valid record at the start of data, 0 if there is none
+size_t store_record(const uint8_t *data, size_t size) {
+    if (size < STORE_RECORD_HEADER) return 0;
+    Reader reader(data, size);
+    size_t payload = reader.get(4);
+    uint64_t checksum = reader.get(8);
+    if (payload < 6 || STORE_RECORD_HEADER + payload > min<size_t>(size, STORE_RECORD_MAX)) return 0;
+    if (fnv1a(data + STORE_RECORD_HEADER, payload) != checksum) return 0;
+    if (payload != 6 + 4 * (size_t)data[STORE_RECORD_HEADER + 1] + 16) return 0;
+    return STORE_RECORD_HEADER + payload;
+}
+
+struct ResultStore {
+    mutex lock, compacting;
+    string path;
+    int fd;
+    uint64_t end, live; // bytes in the log, and in records still indexed
+    bool dirty; // appended since the last sync
+    unordered_map<string, uint64_t> index;
+
+    ResultStore(const string &path) : path(path), end(0), live(0), dirty(false) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) throw StoreException();
+
+        // the destructor does not run when the constructor throws
+        try {
+            if (flock(fd, LOCK_EX | LOCK_NB) != 0) throw StoreException();
+            off_t length = lseek(fd, 0, SEEK_END);
+            if (length < 0) throw StoreException();
+            vector<uint8_t> log(length);
+            if (pread(fd, log.data(), log.size(), 0) != (ssize_t)log.size()) throw StoreException();
+            for (size_t size; (size = store_record(log.data() + end, log.size() - end)) > 0; end += size) {
+                string key((const char*)log.data() + end + STORE_RECORD_HEADER, size - STORE_RECORD_HEADER - 16);
+                auto it = index.find(key);
+                if (it != index.end()) live -= size_at(log.data() + it->second);
+                index[key] = end;
+                live += size;
+            }
+            if (end < log.size() && ftruncate(fd, end) != 0) throw StoreException();
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+
+    ~ResultStore() {
+        close(fd);
+    }
+
+    static size_t size_at(const uint8_t *record) {
+        return STORE_RECORD_HEADER + Reader(record, 4).get(4);
+    }
+
+    bool get(const TableKey &key, int32_t target, Response &response) {
+        string bytes = store_key(key, target);
+        uint8_t record[STORE_RECORD_MAX];
+        lock_guard<mutex> guard(lock);
+        auto it = index.find(bytes);
+        if (it == index.end()) return false;
+
+        size_t size = STORE_RECORD_HEADER + bytes.size() + 16;
+        if (pread(fd, record, size, it->second) != (ssize_t)size || store_record(record, size) != size) return false;
+        Reader reader(record + size - 16, 16);
+        uint64_t value = reader.get(8);
+        memcpy(&response.value, &value, sizeof(value));
+        response.expr = reader.get(8);
+        return true;
+    }
+
+    void put(const TableKey &key, int32_t target, const Response &response) {
+        string bytes = store_key(key, target);
+        uint8_t record[STORE_RECORD_MAX];
+        Writer writer(record + STORE_RECORD_HEADER);
+        for (char byte : bytes) writer.put((uint8_t)byte, 1);
+        writer.put(packed_key(response.value), 8);
+        writer.put(response.expr, 8);
+        Writer header(record);
+        header.put(writer.size, 4);
+        header.put(fnv1a(record + STORE_RECORD_HEADER, writer.size), 8);
+        size_t size = STORE_RECORD_HEADER + writer.size;
+
+        lock_guard<mutex> guard(lock);
+        if (pwrite(fd, record, size, end) != (ssize_t)size) return;
+        auto it = index.find(bytes);
+        if (it != index.end()) live -= size;
+        index[bytes] = end;
+        end += size;
+        live += size;
+        dirty = true;
+    }
+
+    void sync() {
+        int target;
+        {
+            lock_guard<mutex> guard(lock);
+            if (!dirty) return;
+            dirty = false;
+            target = dup(fd);
+        }
+        fdatasync(target);
+        close(target);
+    }
+
+    // Copies the live records into a new log, which replaces the old one.
+    // Records appended meanwhile are carried over under the lock at the end.
+    void compact() {
+        lock_guard<mutex> single(compacting);
+        vector<pair<string, uint64_t>> records;
+        uint64_t start;
+        int from;
+        {
+            lock_guard<mutex> guard(lock);
+            records.assign(index.begin(), index.end());
+            start = end;
+            from = dup(fd);
+        }
+
+        string tmp = path + ".compact";
+        // locked before the rename, so the new log is never open to others
+        int to = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (to < 0 || flock(to, LOCK_EX | LOCK_NB) != 0) {
+            if (to >= 0) close(to);
+            close(from);
+            return;
+        }
+
+        unordered_map<string, uint64_t> moved;
+        uint64_t written = 0;
+        uint8_t record[STORE_RECORD_MAX];
+        auto carry = [&](const string &key, uint64_t offset) {
+            size_t size = STORE_RECORD_HEADER + key.size() + 16;
+            if (pread(from, record, size, offset) != (ssize_t)size || store_record(record, size) != size) return true;
+            if (pwrite(to, record, size, written) != (ssize_t)size) return false;
+            moved[key] = written;
+            written += size;
+            return true;
+        };
+
+        bool ok = true;
+        for (size_t i = 0; ok && i < records.size(); i++) ok = carry(records[i].first, records[i].second);
+
+        lock_guard<mutex> guard(lock);
+        for (auto it = index.begin(); ok && it != index.end(); ++it) {
+            if (it->second >= start) ok = carry(it->first, it->second);
+        }
+        close(from);
+        if (!ok || fsync(to) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+            close(to);
+            unlink(tmp.c_str());
+            return;
+        }
+        sync_directory(path);
+
+        close(fd);
+        fd = to;
+        index.swap(moved);
+        end = written;
+        live = 0;
+        for (auto &entry : index) live += STORE_RECORD_HEADER + entry.first.size() + 16;
+        dirty = false;
+    }
+
+    // makes a rename durable
+    static void sync_directory(const string &path) {
+        size_t slash = path.rfind('/');
+        string directory = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int dir = open(directory.c_str(), O_RDONLY);
+        if (dir < 0) return;
+        fsync(dir);
+        close(dir);
+    }
+};
+
+// syncs the store once a second, and compacts it once most of it is dead
+void maintain(ResultStore &store, const atomic<bool> &stop) {
+    while (!stop) {
+        this_thread::sleep_for(chrono::seconds(1));
+        store.sync();
+
+        uint64_t end, live;
+        {
+            lock_guard<mutex> guard(store.lock);
+            end = store.end;
+            live = store.live;
+        }
+        if (end > STORE_COMPACT_BYTES && end > 2 * live) store.compact();
+    }
+    store.sync();
+}
+
+/********************************************************************
+SOLUTION DATABASE
+********************************************************************/
+
+// the standard Countdown deck: two of each small number, one of each large
+const vector<int32_t> DECK = {1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 25, 50, 75, 100};
+
+// The answer to every Countdown round, for each selection of six cards and
+// target from 100 to 999, in a few tens of megabytes. Per selection a block
+// holds a bitmap of the values reachable exactly from DATABASE_LOW to
+// DATABASE_HIGH and, for each reachable value in order, a provenance code:
+// the mask of cards used and the rank of the expression over them. The
+// best value for a target is the nearest set bit, its expression the code
+// at the bit's rank. Blocks never straddle a page, so a lookup reads one.
+//
+// header:    magic u64, version u32, count u32, size u64, checksum u64
+//            (FNV-1a of everything after the header)
+// directory: count * (cards u8 * 6, padding u16, offset u64), by cards
+// block:     cards u8 * 6, reachable u16, bitmap u64 * DATABASE_WORDS,
+//            codes u32 * reachable
+#define DATABASE_MAGIC 0x31424d554e434c43ULL
+#define DATABASE_VERSION 1
+#define DATABASE_HEADER 32
+#define DATABASE_ENTRY 16
+#define DATABASE_CARDS 6
+#define DATABASE_LOW 90
+#define DATABASE_HIGH 1009
+#define DATABASE_WORDS ((DATABASE_HIGH - DATABASE_LOW + 64) / 64)
+#define DATABASE_PAGE 4096
+
+// every distinct selection of cards from the deck, sorted
+vector<vector<int32_t>> selections(const vector<int32_t> &deck, int cards) {
+    vector<bool> chosen(deck.size(), false);
+    fill(chosen.begin(), chosen.begin() + cards, true);
+    set<vector<int32_t>> distinct;
+    do {
+        vector<int32_t> selection;
+        for (size_t i = 0; i < deck.size(); i++) {
+            if (chosen[i]) selection.push_back(deck[i]);
+        }
+        sort(selection.begin(), selection.end());
+        distinct.insert(selection);
+    } while (prev_permutation(chosen.begin(), chosen.end()));
+    return vector<vector<int32_t>>(distinct.begin(), distinct.end());
+}
+
+// the cards of the mask, in order
+vector<double> masked(const vector<double> &numbers, unsigned mask) {
+    vector<double> result;
+    for (size_t i = 0; i < numbers.size(); i++) {
+        if (mask & (1u << i)) result.push_back(numbers[i]);
+    }
+    return result;
+}
+
+// renumber the codes of an expression from cards to positions among the mask
+Packed compress_codes(Packed expr, unsigned mask, bool expand) {
+    vector<int> positions;
+    for (int i = 0; i < PACKED_NUMBERS; i++) {
+        if (mask & (1u << i)) positions.push_back(i);
+    }
+
+    Packed result = PACKED_OPEN;
+    for (int i = 0; i < packed_length(expr); i++) {
+        int code = packed_code(expr, i);
+        if (!packed_is_op(code)) code = expand ? positions[code] : lower_bound(positions.begin(), positions.end(), code) - positions.begin();
+        result = packed_fill_left(result, code);
+    }
+    return result;
+}
+
+// what the reverse index needs of a selection, for every value in range:
+// the fewest operations reaching it (0xff if none) and the number of
+// distinct solutions, as count_solutions counts them
+struct SelectionStats {
+    vector<uint8_t> operations;
+    vector<uint64_t> solutions;
+};
+
+// the block of one selection, built with Countdown rules
+vector<uint8_t> database_block(const vector<int32_t> &cards, long long &explored, SelectionStats *stats = nullptr) {
+    vector<double> numbers(cards.begin(), cards.end());
+    SubsetTables tables = build_tables(numbers, explored, true, RULES_COUNTDOWN);
+
+    // smallest subsets first, so every value gets its simplest provenance
+    vector<unsigned> masks;
+    for (unsigned mask = 1; mask < tables.values.size(); mask++) masks.push_back(mask);
+    stable_sort(masks.begin(), masks.end(), [](unsigned lhs, unsigned rhs) { return __builtin_popcount(lhs) < __builtin_popcount(rhs); });
+    vector<unsigned> provenance(DATABASE_HIGH - DATABASE_LOW + 1, 0);
+    if (stats) {
+        stats->operations.assign(provenance.size(), 0xff);
+        stats->solutions.assign(provenance.size(), 0);
+        for (const pair<double, uint64_t> &value : solution_counts(count_tables(numbers, RULES_COUNTDOWN))) {
+            if (value.first >= DATABASE_LOW && value.first <= DATABASE_HIGH) stats->solutions[(int)value.first - DATABASE_LOW] = value.second;
+        }
+    }
+    for (unsigned mask : masks) {
+        auto first = lower_bound(tables.values[mask].begin(), tables.values[mask].end(), (double)DATABASE_LOW);
+        auto last = upper_bound(first, tables.values[mask].end(), (double)DATABASE_HIGH);
+        for (; first != last; ++first) {
+            int value = (int)*first - DATABASE_LOW;
+            if (!provenance[value]) {
+                provenance[value] = mask;
+                if (stats) stats->operations[value] = __builtin_popcount(mask) - 1;
+            }
+        }
+    }
+
+    vector<uint64_t> bitmap(DATABASE_WORDS, 0);
+    vector<uint32_t> codes;
+    map<unsigned, ExprSpace> spaces;
+    for (int value = DATABASE_LOW; value <= DATABASE_HIGH; value++) {
+        unsigned mask = provenance[value - DATABASE_LOW];
+        if (!mask) continue;
+        bitmap[(value - DATABASE_LOW) / 64] |= 1ULL << ((value - DATABASE_LOW) % 64);
+        Packed expr = compress_codes(reconstruct_packed(tables, mask, value), mask, false);
+        auto space = spaces.emplace(mask, ExprSpace(masked(numbers, mask))).first;
+        codes.push_back((uint32_t)(rank_expr(space->second, expr) << DATABASE_CARDS | mask));
+    }
+
+    vector<uint8_t> block(8 + 8 * DATABASE_WORDS + 4 * codes.size());
+    Writer writer(block.data());
+    for (int32_t card : cards) writer.put(card, 1);
+    writer.put(codes.size(), 2);
+    for (uint64_t word : bitmap) writer.put(word, 8);
+    for (uint32_t code : codes) writer.put(code, 4);
+    return block;
+}
+
+// builds the blocks on all threads, then lays them out page by page
+void write_database(const string &path, const vector<vector<int32_t>> &cards, int threads, vector<SelectionStats> *stats = nullptr) {
+    vector<vector<uint8_t>> blocks(cards.size());
+    if (stats) stats->assign(cards.size(), SelectionStats());
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (int t = 0; t < max(threads, 1); t++) {
+        workers.emplace_back([&]() {
+            long long explored = 0;
+            for (size_t i; (i = next++) < cards.size();) blocks[i] = database_block(cards[i], explored, stats ? &(*stats)[i] : nullptr);
+        });
+    }
+    for (thread &worker : workers) worker.join();
+
+    size_t directory = DATABASE_HEADER + DATABASE_ENTRY * cards.size();
+    vector<uint64_t> offsets;
+    size_t size = (directory + DATABASE_PAGE - 1) / DATABASE_PAGE * DATABASE_PAGE;
+    for (const vector<uint8_t> &block : blocks) {
+        if (size / DATABASE_PAGE != (size + block.size() - 1) / DATABASE_PAGE) size = (size + DATABASE_PAGE - 1) / DATABASE_PAGE * DATABASE_PAGE;
+        offsets.push_back(size);
+        size = (size + block.size() + 7) & ~(size_t)7;
+    }
+
+    vector<uint8_t> out(size, 0);
+    Writer header(out.data());
+    header.put(DATABASE_MAGIC, 8);
+    header.put(DATABASE_VERSION, 4);
+    header.put(cards.size(), 4);
+    header.put(size, 8);
+    for (size_t i = 0; i < cards.size(); i++) {
+        Writer entry(out.data() + DATABASE_HEADER + DATABASE_ENTRY * i);
+        for (int32_t card : cards[i]) entry.put(card, 1);
+        entry.put(0, 2);
+        entry.put(offsets[i], 8);
+        copy(blocks[i].begin(), blocks[i].end(), out.begin() + offsets[i]);
+    }
+    header.put(fnv1a(out.data() + DATABASE_HEADER, size - DATABASE_HEADER), 8);
+    if (!write_file(path, out)) throw DatabaseException();
+}
+
+struct Database {
+    const uint8_t *memory;
+    size_t size, count;
+
+    Database() : memory(nullptr), size(0), count(0) {}
+    ~Database() {
+        if (memory) munmap((void*)memory, size);
+    }
+
+    // the block of the sorted cards, nullptr if they are not a selection
+    const uint8_t* block(const vector<int32_t> &cards) const {
+        if (cards.size() != DATABASE_CARDS) return nullptr;
+        uint8_t key[DATABASE_CARDS];
+        for (int i = 0; i < DATABASE_CARDS; i++) {
+            if (cards[i] < 0 || cards[i] > 255) return nullptr;
+            key[i] = cards[i];
+        }
+
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            const uint8_t *entry = memory + DATABASE_HEADER + DATABASE_ENTRY * mid;
+            int order = memcmp(entry, key, DATABASE_CARDS);
+            if (order == 0) return memory + get_at(entry, 8, 8);
+            if (order < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        return nullptr;
+    }
+
+    vector<int32_t> cards(size_t id) const {
+        const uint8_t *entry = memory + DATABASE_HEADER + DATABASE_ENTRY * id;
+        return vector<int32_t>(entry, entry + DATABASE_CARDS);
+    }
+};
+
+shared_ptr<Database> open_database(const string &path) {
+    shared_ptr<Database> database = make_shared<Database>();
+    database->memory = map_file(path, database->size);
+    if (!database->memory) throw DatabaseException();
+    size_t size = database->size;
+    if (size < DATABASE_HEADER || get_at(database->memory, 0, 8) != DATABASE_MAGIC || get_at(database->memory, 8, 4) != DATABASE_VERSION) throw DatabaseException();
+    if (get_at(database->memory, 16, 8) != size) throw DatabaseException();
+    if (get_at(database->memory, 24, 8) != fnv1a(database->memory + DATABASE_HEADER, size - DATABASE_HEADER)) throw DatabaseException();
+    database->count = get_at(database->memory, 12, 4);
+    if (DATABASE_HEADER + DATABASE_ENTRY * database->count > size) throw DatabaseException();
+    return database;
+}
+
+inline bool block_reachable(const uint8_t *block, int value) {
+    return get_at(block, 8 + 8 * ((value - DATABASE_LOW) / 64), 8) >> ((value - DATABASE_LOW) % 64) & 1;
+}
+
+// the expression of a reachable value, over the sorted cards
+Packed block_expr(const uint8_t *block, int value) {
+    int bit = value - DATABASE_LOW, index = 0;
+    for (int word = 0; word < bit / 64; word++) index += __builtin_popcountll(get_at(block, 8 + 8 * word, 8));
+    index += __builtin_popcountll(get_at(block, 8 + 8 * (bit / 64), 8) & ((1ULL << (bit % 64)) - 1));
+
+    uint32_t code = get_at(block, 8 + 8 * DATABASE_WORDS + 4 * index, 4);
+    unsigned mask = code & ((1u << DATABASE_CARDS) - 1);
+    vector<double> cards;
+    for (int i = 0; i < DATABASE_CARDS; i++) cards.push_back(block[i]);
+    return compress_codes(unrank_expr(ExprSpace(masked(cards, mask)), code >> DATABASE_CARDS), mask, true);
+}
+
+// Countdown answers for selections in the database; false when a value
+// outside the stored range could be nearer than any inside it
+bool database_lookup(const Database &database, const TableKey &key, int32_t target, Response &response) {
+    if (key.first != RULES_COUNTDOWN || target < DATABASE_LOW || target > DATABASE_HIGH) return false;
+    const uint8_t *block = database.block(key.second);
+    if (!block) return false;
+
+    int reach = min(target - DATABASE_LOW, DATABASE_HIGH - target);
+    for (int distance = 0; distance <= reach; distance++) {
+        for (int value : {target - distance, target + distance}) {
+            if (!block_reachable(block, value)) continue;
+            response.value = value;
+            response.expr = block_expr(block, value);
+            return true;
+        }
+    }
+    return false;
+}
+
+/********************************************************************
+REVERSE INDEX
+********************************************************************/
+
+// Which selections of the database reach a target, for puzzle design. For
+// every target and fewest operations reaching it there is a posting list
+// of selections, by their position in the database directory, each with the
+// number of distinct solutions for the target. Ids are delta coded, both as
+// varints; a filter on operations skips whole lists.
+//
+// header:    magic u64, version u32, lists u32, size u64, checksum u64
+//            (FNV-1a of everything after the header)
+// directory: per value from DATABASE_LOW, per operations 0 .. CARDS-1:
+//            offset u64, postings u32, bytes u32
+// lists:     postings * (id delta varint, solutions varint)
+#define INDEX_MAGIC 0x31584449554e434cULL
+#define INDEX_VERSION 2
+#define INDEX_HEADER 32
+#define INDEX_ENTRY 16
+
+void put_varint(vector<uint8_t> &out, uint64_t value) {
+    for (; value >= 0x80; value >>= 7) out.push_back((uint8_t)(value | 0x80));
+    out.push_back((uint8_t)value);
+}
+
+uint64_t get_varint(const uint8_t *&data) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = *data++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) return value;
+    }
+}
+
+void write_index(const string &path, const vector<SelectionStats> &stats) {
+    size_t count = (DATABASE_HIGH - DATABASE_LOW + 1) * DATABASE_CARDS;
+    vector<vector<uint8_t>> lists(count);
+    vector<uint32_t> postings(count, 0), last(count, 0);
+    for (size_t id = 0; id < stats.size(); id++) {
+        for (size_t value = 0; value < stats[id].operations.size(); value++) {
+            if (stats[id].operations[value] == 0xff) continue;
+            size_t list = value * DATABASE_CARDS + stats[id].operations[value];
+            put_varint(lists[list], id - last[list]);
+            put_varint(lists[list], stats[id].solutions[value]);
+            last[list] = id;
+            postings[list]++;
+        }
+    }
+
+    size_t size = INDEX_HEADER + INDEX_ENTRY * count;
+    for (const vector<uint8_t> &list : lists) size += list.size();
+    vector<uint8_t> out(size, 0);
+    Writer header(out.data());
+    header.put(INDEX_MAGIC, 8);
+    header.put(INDEX_VERSION, 4);
+    header.put(count, 4);
+    header.put(size, 8);
+
+    size_t offset = INDEX_HEADER + INDEX_ENTRY * count;
+    for (size_t list = 0; list < count; list++) {
+        Writer entry(out.data() + INDEX_HEADER + INDEX_ENTRY * list);
+        entry.put(offset, 8);
+        entry.put(postings[list], 4);
+        entry.put(lists[list].size(), 4);
+        copy(lists[list].begin(), lists[list].end(), out.begin() + offset);
+        offset += lists[list].size();
+    }
+    header.put(fnv1a(out.data() + INDEX_HEADER, size - INDEX_HEADER), 8);
+    if (!write_file(path, out)) throw DatabaseException();
+}
+
+struct ReverseIndex {
+    const uint8_t *memory;
+    size_t size;
+
+    ReverseIndex() : memory(nullptr), size(0) {}
+    ~ReverseIndex() {
+        if (memory) munmap((void*)memory, size);
+    }
+};
+
+shared_ptr<ReverseIndex> open_index(const string &path) {
+    shared_ptr<ReverseIndex> index = make_shared<ReverseIndex>();
+    index->memory = map_file(path, index->size);
+    if (!index->memory) throw DatabaseException();
+    const uint8_t *memory = index->memory;
+    size_t count = (DATABASE_HIGH - DATABASE_LOW + 1) * DATABASE_CARDS;
+    if (index->size < INDEX_HEADER || get_at(memory, 0, 8) != INDEX_MAGIC || get_at(memory, 8, 4) != INDEX_VERSION) throw DatabaseException();
+    if (get_at(memory, 12, 4) != count || get_at(memory, 16, 8) != index->size) throw DatabaseException();
+    if (get_at(memory, 24, 8) != fnv1a(memory + INDEX_HEADER, index->size - INDEX_HEADER)) throw DatabaseException();
+    return index;
+}
+
+struct Posting {
+    uint32_t id;
+    uint64_t solutions;
+    int operations;
+};
+
+// the selections reaching the target with fewest operations and number of
+// solutions within the bounds, by id
+vector<Posting> index_query(const ReverseIndex &index, int target, int min_operations, int max_operations, uint64_t min_solutions, uint64_t max_solutions) {
+    vector<Posting> result;
+    if (target < DATABASE_LOW || target > DATABASE_HIGH) return result;
+
+    for (int operations = max(min_operations, 0); operations <= min(max_operations, DATABASE_CARDS - 1); operations++) {
+        const uint8_t *entry = index.memory + INDEX_HEADER + INDEX_ENTRY * ((target - DATABASE_LOW) * DATABASE_CARDS + operations);
+        const uint8_t *list = index.memory + get_at(entry, 0, 8);
+        uint32_t id = 0;
+        for (uint32_t i = 0, postings = get_at(entry, 8, 4); i < postings; i++) {
+            id += get_varint(list);
+            uint64_t solutions = get_varint(list);
+            if (solutions >= min_solutions && solutions <= max_solutions) result.push_back(Posting{id, solutions, operations});
+        }
+    }
+
+    sort(result.begin(), result.end(), [](const Posting &lhs, const Posting &rhs) { return lhs.id < rhs.id; });
+    return result;
+}
+
+/********************************************************************
+REACHABILITY BITMAPS
+********************************************************************/
+
+// Which targets from REACH_LOW to REACH_HIGH each selection makes, one bit
+// per target, for questions about many selections at once. A matrix has a
+// row per selection, or per selection and number of cards where the row for
+// k cards holds the targets made with at most k. Rows are whole words back
+// to back, so set questions are AND, OR and popcount over contiguous words
+// in loops of fixed length. The AND and OR loops unroll; popcount is a
+// libgcc call per word unless built with -mpopcnt or a -march that has it.
+#define REACH_LOW 100
+#define REACH_HIGH 999
+#define REACH_WORDS ((REACH_HIGH - REACH_LOW + 64) / 64)
+
+struct ReachMatrix {
+    size_t selections;
+    int cards; // rows per selection
+    vector<uint64_t> words;
+
+    ReachMatrix(size_t selections = 0, int cards = 1) : selections(selections), cards(cards), words(selections * cards * REACH_WORDS, 0) {}
+
+    // the row of at most used cards, 0 for any number
+    uint64_t* row(size_t id, int used = 0) {
+        return words.data() + (id * cards + (used ? used : cards) - 1) * REACH_WORDS;
+    }
+
+    const uint64_t* row(size_t id, int used = 0) const {
+        return words.data() + (id * cards + (used ? used : cards) - 1) * REACH_WORDS;
+    }
+};
+
+inline void reach_set(uint64_t *row, int target) {
+    row[(target - REACH_LOW) / 64] |= 1ULL << ((target - REACH_LOW) % 64);
+}
+
+inline bool reach_test(const uint64_t *row, int target) {
+    return row[(target - REACH_LOW) / 64] >> ((target - REACH_LOW) % 64) & 1;
+}
+
+inline int reach_count(const uint64_t *row) {
+    int count = 0;
+    for (int word = 0; word < REACH_WORDS; word++) count += __builtin_popcountll(row[word]);
+    return count;
+}
+
+// one row per selection of the database
+ReachMatrix reach_matrix(const Database &database) {
+    ReachMatrix matrix(database.count);
+    for (size_t id = 0; id < database.count; id++) {
+        const uint8_t *block = database.memory + get_at(database.memory + DATABASE_HEADER + DATABASE_ENTRY * id, 8, 8);
+        uint64_t *row = matrix.row(id);
+        for (int target = REACH_LOW; target <= REACH_HIGH; target++) {
+            if (block_reachable(block, target)) reach_set(row, target);
+        }
+    }
+    return matrix;
+}
+
+// one row per selection and number of cards, from the fewest operations in
+// the reverse index
+ReachMatrix reach_matrix(const ReverseIndex &index, size_t selections) {
+    ReachMatrix matrix(selections, DATABASE_CARDS);
+    for (int target = REACH_LOW; target <= REACH_HIGH; target++) {
+        for (int operations = 0; operations < DATABASE_CARDS; operations++) {
+            const uint8_t *entry = index.memory + INDEX_HEADER + INDEX_ENTRY * ((target - DATABASE_LOW) * DATABASE_CARDS + operations);
+            const uint8_t *list = index.memory + get_at(entry, 0, 8);
+            uint32_t id = 0;
+            for (uint32_t i = 0, postings = get_at(entry, 8, 4); i < postings; i++) {
+                id += get_varint(list);
+                get_varint(list);
+                if (id < selections) reach_set(matrix.row(id, operations + 1), target);
+            }
+        }
+    }
+    for (size_t id = 0; id < selections; id++) {
+        for (int used = 2; used <= DATABASE_CARDS; used++) {
+            for (int word = 0; word < REACH_WORDS; word++) matrix.row(id, used)[word] |= matrix.row(id, used - 1)[word];
+        }
+    }
+    return matrix;
+}
+
+// the targets every selection makes with at most used cards
+void reach_all(const ReachMatrix &matrix, int used, uint64_t out[REACH_WORDS]) {
+    fill(out, out + REACH_WORDS, ~0ULL);
+    for (size_t id = 0; id < matrix.selections; id++) {
+        const uint64_t *row = matrix.row(id, used);
+        for (int word = 0; word < REACH_WORDS; word++) out[word] &= row[word];
+    }
+    if ((REACH_HIGH - REACH_LOW + 1) % 64) out[REACH_WORDS - 1] &= (1ULL << ((REACH_HIGH - REACH_LOW + 1) % 64)) - 1;
+}
+
+// the targets some selection makes with at most used cards
+void reach_any(const ReachMatrix &matrix, int used, uint64_t out[REACH_WORDS]) {
+    fill(out, out + REACH_WORDS, 0ULL);
+    for (size_t id = 0; id < matrix.selections; id++) {
+        const uint64_t *row = matrix.row(id, used);
+        for (int word = 0; word < REACH_WORDS; word++) out[word] |= row[word];
+    }
+}
+
+// the selections making every target of the set with at most used cards
+vector<uint32_t> reach_covering(const ReachMatrix &matrix, int used, const uint64_t targets[REACH_WORDS]) {
+    vector<uint32_t> result;
+    for (size_t id = 0; id < matrix.selections; id++) {
+        const uint64_t *row = matrix.row(id, used);
+        uint64_t missing = 0;
+        for (int word = 0; word < REACH_WORDS; word++) missing |= targets[word] & ~row[word];
+        if (!missing) result.push_back(id);
+    }
+    return result;
+}
+
+// for every target, how many selections make it with at most used cards
+vector<uint32_t> reach_counts(const ReachMatrix &matrix, int used) {
+    vector<uint32_t> counts(REACH_HIGH - REACH_LOW + 1, 0);
+    for (size_t id = 0; id < matrix.selections; id++) {
+        const uint64_t *row = matrix.row(id, used);
+        for (int word = 0; word < REACH_WORDS; word++) {
+            for (uint64_t bits = row[word]; bits; bits &= bits - 1) counts[word * 64 + __builtin_ctzll(bits)]++;
+        }
+    }
+    return counts;
+}
+
+/********************************************************************
+HOT RELOAD
+********************************************************************/
+
+// Mapped files are swapped while serving, read-copy-update style. A reader
+// announces the epoch it started in for the duration of a request; a writer
+// publishes the new mapping, opens a new epoch and waits until no reader is
+// left in an older one before it unmaps the old file. Readers never block
+// or write shared cache lines other than their own.
+struct alignas(64) RcuReader {
+    atomic<uint64_t> epoch; // 0 while outside
+};
+
+struct RcuDomain {
+    atomic<uint64_t> epoch;
+    mutex lock;
+    list<RcuReader> readers;
+
+    RcuDomain() : epoch(1) {}
+
+    // the reader of the calling thread, registered on first use
+    RcuReader& reader() {
+        thread_local RcuReader *self = nullptr;
+        if (!self) {
+            lock_guard<mutex> guard(lock);
+            readers.emplace_back();
+            self = &readers.back();
+            self->epoch.store(0);
+        }
+        return *self;
+    }
+
+    // waits until every reader has left the epochs before now
+    void synchronize() {
+        uint64_t now = epoch.fetch_add(1) + 1;
+        lock_guard<mutex> guard(lock);
+        for (RcuReader &reader : readers) {
+            for (int idle = 0;; backoff(idle)) {
+                uint64_t seen = reader.epoch.load();
+                if (seen == 0 || seen >= now) break;
+            }
+        }
+    }
+} rcu;
+
+// published objects may be read between construction and destruction
+struct RcuGuard {
+    RcuReader &reader;
+
+    RcuGuard() : reader(rcu.reader()) {
+        reader.epoch.store(rcu.epoch.load());
+    }
+
+    ~RcuGuard() {
+        reader.epoch.store(0, memory_order_release);
+    }
+};
+
+template<class T>
+struct Published {
+    atomic<T*> current;
+    shared_ptr<T> owner;
+    mutex lock; // one writer at a time
+
+    Published(shared_ptr<T> initial = nullptr) : current(initial.get()), owner(initial) {}
+
+    // valid while the caller holds an RcuGuard
+    const T* get() const {
+        return current.load();
+    }
+
+    // the old object is released once no reader can hold it
+    void publish(shared_ptr<T> next) {
+        lock_guard<mutex> guard(lock);
+        current.store(next.get());
+        rcu.synchronize();
+        owner = next;
+    }
+};
+
+// polls the file once a second and publishes it again when it is replaced;
+// a file that does not open keeps the old one in service
+template<class T>
+void reload(Published<T> &published, const string &path, function<shared_ptr<T>(const string&)> open, const atomic<bool> &stop) {
+    struct stat last;
+    bool known = stat(path.c_str(), &last) == 0;
+    while (!stop) {
+        this_thread::sleep_for(chrono::seconds(1));
+        struct stat now;
+        if (stat(path.c_str(), &now) != 0) continue;
+        if (known && now.st_ino == last.st_ino && now.st_size == last.st_size && now.st_mtime == last.st_mtime) continue;
+        last = now;
+        known = true;
+
+        try {
+            published.publish(open(path));
+            cerr << "reloaded " << path << endl;
+        } catch (exception &e) {
+            cerr << "cannot reload " << path << ": " << e.what() << endl;
+        }
+    }
+}
+
+/********************************************************************
+HARDNESS ATLAS
+********************************************************************/
+
+// The difficulty of every Countdown round, for analysis: per selection and
+// target whether it is solvable, the number of distinct solutions as
+// count_tables counts them, the fewest operations needed, and the nodes the
+// depth first search expands before it stops. The search plays by Countdown
+// rules over as many cards as the fewest operations take and gives up at a
+// limit, which capped rows reach; it is not run when the target cannot be
+// made, leaving 0 nodes.
+//
+// The job runs chunks of selections on all threads. Every finished chunk is
+// a columnar file of its own, so a restarted job skips it; when all are done
+// they are merged into one:
+//
+// header:  magic u64, version u32, columns u32, rows u64, dfs limit u64
+// columns: name char * 16, width u32, padding u32, offset u64
+// data:    each column's values in row order, 8 byte aligned
+//
+// A chunk left by a run with another limit is built again.
+#define ATLAS_MAGIC 0x314c5441554e434cULL
+#define ATLAS_VERSION 2
+#define ATLAS_HEADER 32
+#define ATLAS_COLUMN 32
+#define ATLAS_LOW 100
+#define ATLAS_HIGH 999
+
+struct Atlas {
+    vector<uint32_t> selection;
+    vector<uint16_t> target;
+    vector<uint8_t> solvable;
+    vector<uint64_t> solutions;
+    vector<uint8_t> operations; // 0xff if not solvable
+    vector<uint64_t> nodes;
+    vector<uint8_t> capped; // the search stopped at the limit
+    long long dfs_limit;
+
+    Atlas() : dfs_limit(0) {}
+
+    void append(const Atlas &other) {
+        selection.insert(selection.end(), other.selection.begin(), other.selection.end());
+        target.insert(target.end(), other.target.begin(), other.target.end());
+        solvable.insert(solvable.end(), other.solvable.begin(), other.solvable.end());
+        solutions.insert(solutions.end(), other.solutions.begin(), other.solutions.end());
+        operations.insert(operations.end(), other.operations.begin(), other.operations.end());
+        nodes.insert(nodes.end(), other.nodes.begin(), other.nodes.end());
+        capped.insert(capped.end(), other.capped.begin(), other.capped.end());
+    }
+};
+
+// visits the columns with their names, for both writing and reading
+template<class Visit>
+void atlas_columns(Atlas &atlas, Visit visit) {
+    visit("selection", atlas.selection);
+    visit("target", atlas.target);
+    visit("solvable", atlas.solvable);
+    visit("solutions", atlas.solutions);
+    visit("operations", atlas.operations);
+    visit("dfs_nodes", atlas.nodes);
+    visit("dfs_capped", atlas.capped);
+}
+
+void write_atlas(const string &path, Atlas &atlas) {
+    uint32_t columns = 0;
+    size_t size = ATLAS_HEADER;
+    atlas_columns(atlas, [&](const char*, auto &column) {
+        columns++;
+        size += ATLAS_COLUMN + ((sizeof(column[0]) * column.size() + 7) & ~(size_t)7);
+    });
+
+    vector<uint8_t> out(size, 0);
+    Writer header(out.data());
+    header.put(ATLAS_MAGIC, 8);
+    header.put(ATLAS_VERSION, 4);
+    header.put(columns, 4);
+    header.put(atlas.selection.size(), 8);
+    header.put(atlas.dfs_limit, 8);
+
+    size_t entry = ATLAS_HEADER, offset = ATLAS_HEADER + ATLAS_COLUMN * columns;
+    atlas_columns(atlas, [&](const char *name, auto &column) {
+        strncpy((char*)out.data() + entry, name, 16);
+        Writer writer(out.data() + entry + 16);
+        writer.put(sizeof(column[0]), 4);
+        writer.put(0, 4);
+        writer.put(offset, 8);
+        entry += ATLAS_COLUMN;
+
+        Writer data(out.data() + offset);
+        for (auto value : column) data.put(value, sizeof(value));
+        offset += (data.size + 7) & ~(size_t)7;
+    });
+    if (!write_file(path, out)) throw DatabaseException();
+}
+
+Atlas read_atlas(const string &path) {
+    ifstream file(path, ios::binary);
+    vector<uint8_t> in((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (in.size() < ATLAS_HEADER || get_at(in.data(), 0, 8) != ATLAS_MAGIC || get_at(in.data(), 8, 4) != ATLAS_VERSION) throw DatabaseException();
+    size_t columns = get_at(in.data(), 12, 4), rows = get_at(in.data(), 16, 8);
+    if (ATLAS_HEADER + ATLAS_COLUMN * columns > in.size()) throw DatabaseException();
+
+    Atlas atlas;
+    atlas.dfs_limit = get_at(in.data(), 24, 8);
+    atlas_columns(atlas, [&](const char *name, auto &column) {
+        for (size_t i = 0; i < columns; i++) {
+            const uint8_t *entry = in.data() + ATLAS_HEADER + ATLAS_COLUMN * i;
+            if (strncmp((const char*)entry, name, 16) != 0) continue;
+            size_t width = get_at(entry, 16, 4), offset = get_at(entry, 24, 8);
+            if (width != sizeof(column[0]) || offset + width * rows > in.size()) throw DatabaseException();
+            column.resize(rows);
+            for (size_t row = 0; row < rows; row++) column[row] = get_at(in.data(), offset + width * row, width);
+        }
+        if (column.size() != rows) throw DatabaseException();
+    });
+    return atlas;
+}
+
+struct AtlasOptions {
+    string path;
+    int threads;
+    size_t chunk; // selections
+    long long dfs_limit; // nodes
+
+    AtlasOptions() : threads(thread::hardware_concurrency()), chunk(64), dfs_limit(100000) {}
+};
+
+Atlas atlas_chunk(const vector<vector<int32_t>> &cards, size_t first, size_t last, long long dfs_limit) {
+    Atlas atlas;
+    atlas.dfs_limit = dfs_limit;
+    for (size_t id = first; id < last; id++) {
+        vector<double> numbers(cards[id].begin(), cards[id].end());
+        CountTables counts = count_tables(numbers, RULES_COUNTDOWN);
+        for (int target = ATLAS_LOW; target <= ATLAS_HIGH; target++) {
+            int operations;
+            uint64_t solutions = count_solutions(counts, target, operations);
+            long long nodes = 0;
+            bool capped = false;
+            if (solutions > 0) {
+                DfsTask search(target, numbers, Scoring(), RULES_COUNTDOWN, operations + 1);
+                search.step(dfs_limit);
+                nodes = search.explored;
+                capped = !search.done();
+            }
+
+            atlas.selection.push_back(id);
+            atlas.target.push_back(target);
+            atlas.solvable.push_back(solutions > 0);
+            atlas.solutions.push_back(solutions);
+            atlas.operations.push_back(operations < 0 ? 0xff : operations);
+            atlas.nodes.push_back(nodes);
+            atlas.capped.push_back(capped);
+        }
+    }
+    return atlas;
+}
+
+void atlas(const AtlasOptions &options) {
+    vector<vector<int32_t>> cards = selections(DECK, DATABASE_CARDS);
+    size_t chunk = max<size_t>(options.chunk, 1), chunks = (cards.size() + chunk - 1) / chunk;
+    string directory = options.path + ".chunks";
+    mkdir(directory.c_str(), 0755);
+    auto chunk_path = [&](size_t c) {
+        ostringstream name;
+        name << directory << "/" << setw(5) << setfill('0') << c * chunk << "-" << setw(5) << min(cards.size(), (c + 1) * chunk);
+        return name.str();
+    };
+
+    atomic<size_t> next(0), done(0);
+    mutex lock;
+    vector<thread> workers;
+    for (int t = 0; t < max(options.threads, 1); t++) {
+        workers.emplace_back([&]() {
+            for (size_t c; (c = next++) < chunks;) {
+                bool built = false;
+                try {
+                    built = access(chunk_path(c).c_str(), F_OK) == 0 && read_atlas(chunk_path(c)).dfs_limit == options.dfs_limit;
+                } catch (DatabaseException &e) {}
+                if (!built) {
+                    Atlas part = atlas_chunk(cards, c * chunk, min(cards.size(), (c + 1) * chunk), options.dfs_limit);
+                    write_atlas(chunk_path(c), part);
+                }
+                lock_guard<mutex> guard(lock);
+                cerr << "\r" << ++done << "/" << chunks << " chunks" << flush;
+            }
+        });
+    }
+    for (thread &worker : workers) worker.join();
+    cerr << endl;
+
+    Atlas all;
+    all.dfs_limit = options.dfs_limit;
+    for (size_t c = 0; c < chunks; c++) all.append(read_atlas(chunk_path(c)));
+    write_atlas(options.path, all);
+    for (size_t c = 0; c < chunks; c++) unlink(chunk_path(c).c_str());
+    rmdir(directory.c_str());
+}
+
+/********************************************************************
+SEARCH SESSIONS
+********************************************************************/
+
+// Searches stopped at their deadline are parked under the session id of
+// their request, so a follow-up with the same id, numbers and target
+// continues where the search stopped instead of starting over. Parked
+// searches expire after a while, and the soonest to expire are dropped
+// first when they take more memory than allowed.
+struct Parked {
+    shared_ptr<DfsTask> task;
+    int32_t target;
+    vector<int32_t> numbers;
+    chrono::steady_clock::time_point expiry;
+    size_t bytes;
+};
+
+size_t task_bytes(const DfsTask &task) {
+    return sizeof(DfsTask) + task.stack.capacity() * sizeof(DfsTask::Frame) + task.numbers.capacity() * sizeof(double);
+}
+
+struct SessionStore {
+    mutex lock;
+    chrono::seconds ttl;
+    size_t capacity, used;
+    map<uint64_t, Parked> parked;
+
+    SessionStore(chrono::seconds ttl, size_t capacity) : ttl(ttl), capacity(capacity), used(0) {}
+
+    void park(uint64_t session, const Request &request, shared_ptr<DfsTask> task) {
+        lock_guard<mutex> guard(lock);
+        drop(session);
+
+        Parked entry{task, request.target, request.numbers, chrono::steady_clock::now() + ttl, task_bytes(*task)};
+        used += entry.bytes;
+        parked[session] = entry;
+        sweep();
+    }
+
+    // the parked search of the session if it is for the same puzzle
+    shared_ptr<DfsTask> claim(uint64_t session, const Request &request) {
+        lock_guard<mutex> guard(lock);
+        sweep();
+
+        auto it = parked.find(session);
+        if (it == parked.end()) return nullptr;
+        shared_ptr<DfsTask> task = it->second.task;
+        bool same = it->second.target == request.target && it->second.numbers == request.numbers;
+        drop(session);
+        return same ? task : nullptr;
+    }
+
+    // the lock must be held
+    void drop(uint64_t session) {
+        auto it = parked.find(session);
+        if (it == parked.end()) return;
+        used -= it->second.bytes;
+        parked.erase(it);
+    }
+
+    // the lock must be held
+    void sweep() {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        for (auto it = parked.begin(); it != parked.end();) {
+            if (it->second.expiry < now) {
+                used -= it->second.bytes;
+                it = parked.erase(it);
+            } else {
+                it++;
+            }
+        }
+
+        while (used > capacity && !parked.empty()) {
+            auto soonest = parked.begin();
+            for (auto it = parked.begin(); it != parked.end(); it++) {
+                if (it->second.expiry < soonest->second.expiry) soonest = it;
+            }
+            drop(soonest->first);
+        }
+    }
+};
+
+/********************************************************************
+CACHE WARMING
+********************************************************************/
+
+// A query log has one request per line: the rules, the target, then the
+// numbers, all separated by spaces. Lines starting with # are ignored.
+void write_query(ostream &log, const Request &request) {
+    log << (int)request.rules << " " << request.target;
+    for (int32_t number : request.numbers) log << " " << number;
+    log << "\n";
+}
+
+bool read_query(const string &line, Request &request) {
+    if (line.empty() || line[0] == '#') return false;
+
+    istringstream in(line);
+    int rules;
+    if (!(in >> rules >> request.target)) return false;
+    request.rules = rules;
+    request.numbers.clear();
+    for (int32_t number; in >> number;) request.numbers.push_back(number);
+    return !request.numbers.empty() && request.numbers.size() <= PACKED_NUMBERS;
+}
+
+// the most frequent number multisets of a query log, most frequent first
+vector<TableKey> popular_keys(const string &path, size_t count) {
+    map<TableKey, long long> frequency;
+    ifstream in(path);
+    Request request;
+    for (string line; getline(in, line);) {
+        if (read_query(line, request)) frequency[table_key(request)]++;
+    }
+
+    vector<pair<long long, TableKey>> ranked;
+    for (auto &entry : frequency) ranked.emplace_back(-entry.second, entry.first);
+    sort(ranked.begin(), ranked.end());
+
+    vector<TableKey> keys;
+    for (size_t i = 0; i < ranked.size() && i < count; i++) keys.push_back(ranked[i].second);
+    return keys;
+}
+
+// Builds the tables for the keys into the cache on an idle priority thread,
+// and only while idle says no request is waiting, so live traffic always
+// goes first. A request for a key being warmed simply joins its build.
+void warm(TableCache &cache, const vector<TableKey> &keys, function<bool()> idle, const atomic<bool> &stop) {
+    sched_param param = {};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    for (const TableKey &key : keys) {
+        while (!stop && !idle()) this_thread::sleep_for(chrono::milliseconds(1));
+        if (stop) return;
+
+        try {
+            long long explored = 0;
+            bool hit;
+            cache.acquire(key, explored, nullptr, chrono::steady_clock::time_point(), hit);
+        } catch (exception &e) {
+            cerr << "cannot warm tables: " << e.what() << endl;
+        }
+    }
+}
+
+/********************************************************************
+SERVER
+********************************************************************/
+
+inline long long elapsed_us(chrono::steady_clock::time_point since) {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - since).count();
+}
+
+// where solve_request looks for tables, in this order
+struct TableSources {
+    const Published<Database> *database;
+    const Published<Snapshot> *snapshot;
+    SharedCache *shared;
+    ResultStore *store;
+    TableCache *cache;
+
+    TableSources() : database(nullptr), snapshot(nullptr), shared(nullptr), store(nullptr), cache(nullptr) {}
+};
+
+// closest value and its expression over the sorted numbers
+template<class Tables>
+void answer(const Tables &tables, const Request &request, Response &response) {
+    unsigned mask;
+    response.value = closest(tables, request.target, mask);
+    response.expr = reconstruct_packed(tables, mask, response.value);
+}
+
+// tables come from the sources, or are built for this request alone
+Response solve_request(const Request &request, chrono::steady_clock::time_point received, long long &explored, Budget *budget = nullptr, const TableSources *sources = nullptr, bool *hit = nullptr) {
+    Response response;
+    response.id = request.id;
+    if (request.numbers.empty() || request.rules > RULES_COUNTDOWN) {
+        response.status = STATUS_INVALID;
+        return response;
+    }
+
+    Budget unlimited;
+    if (!budget) budget = &unlimited;
+    TableSources none;
+    if (!sources) sources = &none;
+    chrono::steady_clock::time_point deadline;
+    if (request.deadline > 0) deadline = received + chrono::microseconds(request.deadline);
+
+    try {
+        TableKey key = table_key(request);
+        bool shared = true, mapped = false;
+        {
+            // the mapped files stay until the guard is gone
+            RcuGuard guard;
+            const Database *database = sources->database ? sources->database->get() : nullptr;
+            const Snapshot *snapshot = sources->snapshot ? sources->snapshot->get() : nullptr;
+            const TableView *view = snapshot ? snapshot->find(key) : nullptr;
+            if (database && database_lookup(*database, key, request.target, response)) mapped = true;
+            else if (view) {
+                answer(*view, request, response);
+                mapped = true;
+            }
+        }
+
+        if (mapped) {
+            // precomputed
+        } else if (sources->shared && shared_result(sources->shared, key, request.target, response)) {
+            // solved by another process
+        } else if (sources->store && sources->store->get(key, request.target, response)) {
+            if (sources->shared) shared_store(sources->shared, key, request.target, response);
+        } else {
+            TableView view;
+            shared_ptr<const SubsetTables> tables;
+            if (sources->shared && shared_tables(sources->shared, key, explored, budget, deadline, view, tables, shared)) {
+                answer(view, request, response);
+            } else {
+                if (tables) shared = false;
+                else if (sources->cache) tables = sources->cache->acquire(key, explored, budget, deadline, shared);
+                else {
+                    shared = false;
+                    budget->deadline = deadline;
+                    tables = make_shared<SubsetTables>(build_tables(vector<double>(key.second.begin(), key.second.end()), explored, true, key.first, budget));
+                }
+                answer(*tables, request, response);
+            }
+            if (sources->shared) shared_store(sources->shared, key, request.target, response);
+            if (sources->store) sources->store->put(key, request.target, response);
+        }
+        if (hit) *hit = shared;
+        response.expr = remap(response.expr, key_positions(request));
+    } catch (BudgetExceededException &e) {
+        response.status = STATUS_OVER_BUDGET;
+    } catch (DeadlineExceededException &e) {
+        response.status = STATUS_EXPIRED;
+    }
+
+    response.elapsed = elapsed_us(received);
+    if (request.deadline > 0 && response.elapsed > request.deadline) response.status = STATUS_EXPIRED;
+    return response;
+}
+
+void respond(Ring *ring, uint32_t channel, const Response &response) {
+    uint8_t bytes[MESSAGE_BYTES];
+    size_t size = encode(response, bytes);
+    channel_respond(ring, channel, bytes, size);
+}
+
+// moves requests from the ring into the scheduler, logging them if asked
+void dispatch(Ring *ring, Scheduler &scheduler, WorkerCounters &counters, ostream *log, const atomic<bool> &stop) {
+    uint8_t bytes[MESSAGE_BYTES];
+    size_t size;
+    uint32_t channel;
+
+    for (int idle = 0; !stop;) {
+        if (!ring_pop(ring, channel, bytes, size)) {
+            backoff(idle);
+            continue;
+        }
+        idle = 0;
+
+        Job job;
+        job.channel = channel;
+        job.received = chrono::steady_clock::now();
+        try {
+            decode(bytes, size, job.request);
+        } catch (ProtocolException &e) {
+            Response response;
+            response.status = STATUS_INVALID;
+            record(counters, response, 0);
+            respond(ring, channel, response);
+            continue;
+        }
+
+        // flushed per record, so a crash keeps the queries leading up to it
+        if (log) {
+            write_query(*log, job.request);
+            log->flush();
+        }
+
+        job.cost = estimate_cost(job.request);
+        if (!scheduler.admit(job)) {
+            Response response;
+            response.id = job.request.id;
+            response.status = STATUS_SHED;
+            record(counters, response, 0);
+            respond(ring, channel, response);
+        }
+    }
+}
+
+struct ServerOptions {
+    string name;
+    int workers;
+    string metrics_file, metrics_socket;
+    size_t interactive_queue, batch_queue;
+    size_t cached_tables;
+    long long slice; // expansions per turn of a search
+    long long session_ttl; // seconds
+    size_t session_memory; // megabytes
+    string query_log, warm_log;
+    size_t warm_count;
+    string snapshot;
+    string shared_cache; // segment name
+    size_t shared_memory; // megabytes of tables in the segment
+    string result_store;
+    string database;
+    long long cpu_limit; // milliseconds per request, 0 for none
+    size_t memory_limit; // megabytes per request, 0 for none
+
+    ServerOptions() : workers(1), interactive_queue(256), batch_queue(4096), cached_tables(64), slice(10000), session_ttl(60), session_memory(64), warm_count(64), shared_memory(256), cpu_limit(0), memory_limit(0) {}
+};
+
+// a depth first search in flight on a worker
+struct Running {
+    Job job;
+    shared_ptr<DfsTask> task;
+    long long cpu_ns;
+};
+
+Response search_response(const Running &running, uint8_t status) {
+    Response response;
+    response.id = running.job.request.id;
+    response.status = status;
+    response.value = running.task->best.value;
+    response.expr = remap(running.task->best.expr, key_positions(running.job.request));
+    response.elapsed = elapsed_us(running.job.received);
+    return response;
+}
+
+// Table jobs run to completion. Searches are interleaved: every round
+// gives each search in flight one slice, and new jobs are only waited for
+// when nothing is in flight, so short queries are not stuck behind long ones.
+void work(Ring *ring, Scheduler &scheduler, const TableSources &sources, SessionStore &sessions, WorkerCounters &counters, const ServerOptions &options, const atomic<bool> &stop) {
+    vector<Running> running;
+    Job job;
+
+    while (!stop) {
+        bool taken = running.empty() ? scheduler.take(job, stop) : scheduler.try_take(job);
+        if (taken && job.request.engine == ENGINE_DFS) {
+            if (job.request.numbers.empty() || job.request.rules != RULES_FREE) {
+                Response response;
+                response.id = job.request.id;
+                response.status = STATUS_INVALID;
+                record(counters, response, 0);
+                respond(ring, job.channel, response);
+            } else {
+                shared_ptr<DfsTask> task;
+                if (job.request.session != 0) task = sessions.claim(job.request.session, job.request);
+                if (!task) task = make_shared<DfsTask>(job.request.target, vector<double>(job.request.numbers.begin(), job.request.numbers.end()));
+                running.push_back(Running{job, task, 0});
+            }
+        } else if (taken) {
+            Budget budget(options.cpu_limit * 1000000, options.memory_limit << 20);
+            long long explored = 0;
+            bool hit = false;
+            Response response = solve_request(job.request, job.received, explored, &budget, &sources, &hit);
+            record(counters, response, explored, hit);
+            respond(ring, job.channel, response);
+        }
+
+        for (size_t i = 0; i < running.size();) {
+            Running &search = running[i];
+            long long start = thread_cpu_ns(), before = search.task->explored;
+            bool finished = search.task->step(options.slice);
+            search.cpu_ns += thread_cpu_ns() - start;
+
+            uint32_t deadline = search.job.request.deadline;
+            uint8_t status = STATUS_OK;
+            if (finished) status = STATUS_OK;
+            else if (deadline > 0 && elapsed_us(search.job.received) > deadline) status = STATUS_PARTIAL;
+            else if (options.cpu_limit > 0 && search.cpu_ns > options.cpu_limit * 1000000) status = STATUS_OVER_BUDGET;
+            else {
+                bump(counters.explored, search.task->explored - before);
+                i++;
+                continue;
+            }
+
+            Response response = search_response(search, status);
+            record(counters, response, search.task->explored - before);
+            respond(ring, search.job.channel, response);
+            if (!finished && search.job.request.session != 0) sessions.park(search.job.request.session, search.job.request, search.task);
+            running.erase(running.begin() + i);
+        }
+    }
+}
+
+atomic<bool> stopped(false);
+
+void serve(const ServerOptions &options) {
+    Published<Snapshot> snapshot(options.snapshot.empty() ? nullptr : open_snapshot(options.snapshot));
+    Published<Database> database(options.database.empty() ? nullptr : open_database(options.database));
+    unique_ptr<ResultStore> store;
+    if (!options.result_store.empty()) store.reset(new ResultStore(options.result_store));
+    Ring *ring = ring_create(options.name.c_str());
+    signal(SIGINT, [](int) { stopped = true; });
+    signal(SIGTERM, [](int) { stopped = true; });
+
+    Scheduler scheduler(options.interactive_queue, options.batch_queue);
+    TableCache cache(options.cached_tables);
+    SharedCache *shared = options.shared_cache.empty() ? nullptr : shared_open(options.shared_cache.c_str(), options.shared_memory << 20);
+    TableSources sources;
+    sources.database = &database;
+    sources.snapshot = &snapshot;
+    sources.shared = shared;
+    sources.store = store.get();
+    sources.cache = &cache;
+    SessionStore sessions(chrono::seconds(options.session_ttl), options.session_memory << 20);
+    MetricsRegistry registry;
+    registry.queue_depth = [ring, &scheduler]() {
+        return (long long)(ring->tail.load(memory_order_relaxed) - ring->head.load(memory_order_relaxed) + scheduler.depth());
+    };
+
+    ofstream log;
+    if (!options.query_log.empty()) log.open(options.query_log, ios::app);
+
+    vector<thread> threads;
+    WorkerCounters *dispatcher = registry.add_worker();
+    threads.emplace_back([ring, &scheduler, dispatcher, &log]() { dispatch(ring, scheduler, *dispatcher, log.is_open() ? &log : nullptr, stopped); });
+    for (int i = 0; i < options.workers; i++) {
+        WorkerCounters *counters = registry.add_worker();
+        threads.emplace_back([ring, &scheduler, &sources, &sessions, counters, &options]() { work(ring, scheduler, sources, sessions, *counters, options, stopped); });
+    }
+    if (!options.warm_log.empty()) {
+        vector<TableKey> keys = popular_keys(options.warm_log, min(options.warm_count, options.cached_tables));
+        threads.emplace_back([&cache, keys, ring, &scheduler]() {
+            warm(cache, keys, [ring, &scheduler]() { return ring->tail.load() == ring->head.load() && scheduler.depth() == 0; }, stopped);
+        });
+    }
+    if (store) {
+        threads.emplace_back([&store]() { maintain(*store, stopped); });
+    }
+    if (!options.snapshot.empty()) {
+        threads.emplace_back([&snapshot, &options]() { reload<Snapshot>(snapshot, options.snapshot, [](const string &path) { return open_snapshot(path); }, stopped); });
+    }
+    if (!options.database.empty()) {
+        threads.emplace_back([&database, &options]() { reload<Database>(database, options.database, open_database, stopped); });
+    }
+    if (!options.metrics_file.empty()) {
+        threads.emplace_back([&registry, &options]() { export_file(registry, options.metrics_file, stopped); });
+    }
+    if (!options.metrics_socket.empty()) {
+        threads.emplace_back([&registry, &options]() { export_socket(registry, options.metrics_socket, stopped); });
+    }
+    for (thread &worker : threads) worker.join();
+
+    ring_close(ring);
+    shm_unlink(options.name.c_str());
+    if (shared) shared_close(shared);
+}
+
+/********************************************************************
+LOAD GENERATOR
+********************************************************************/
+
+// a random Countdown round: six cards and a target from 100 to 999
+Request random_round(mt19937_64 &rng) {
+    vector<int32_t> deck(DECK);
+    shuffle(deck.begin(), deck.end(), rng);
+
+    Request request;
+    request.rules = RULES_COUNTDOWN;
+    request.target = uniform_int_distribution<int32_t>(100, 999)(rng);
+    request.numbers.assign(deck.begin(), deck.begin() + 6);
+    return request;
+}
+
+struct LoadOptions {
+    string name, log;
+    double rate; // requests per second over all clients, 0 for as fast as possible
+    int concurrency;
+    double duration; // seconds
+
+    LoadOptions() : rate(0.), concurrency(1), duration(10.) {}
+};
+
+// Replays the log, or random rounds without one, from concurrent clients.
+// Requests are sent on a fixed schedule and latency counts from when a
+// request was due, so a slow server cannot hide its queueing delay.
+void load(const LoadOptions &options) {
+    vector<Request> requests;
+    if (!options.log.empty()) {
+        ifstream in(options.log);
+        Request request;
+        for (string line; getline(in, line);) {
+            if (read_query(line, request)) requests.push_back(request);
+        }
+    }
+
+    Ring *ring = ring_open(options.name.c_str());
+    int clients = min(options.concurrency, RING_CHANNELS);
+    vector<vector<long long>> latencies(clients);
+    vector<map<int, long long>> statuses(clients);
+    atomic<uint64_t> next(0);
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    chrono::steady_clock::time_point end = begin + chrono::microseconds((long long)(options.duration * 1e6));
+
+    vector<thread> threads;
+    for (int c = 0; c < clients; c++) {
+        threads.emplace_back([&, c]() {
+            int channel = channel_acquire(ring);
+            if (channel < 0) return;
+            mt19937_64 rng(c);
+
+            while (true) {
+                uint64_t i = next++;
+                chrono::steady_clock::time_point due = begin;
+                if (options.rate > 0.) due += chrono::microseconds((long long)(i * 1e6 / options.rate));
+                if (due >= end || chrono::steady_clock::now() >= end) break;
+                this_thread::sleep_until(due);
+                if (options.rate <= 0.) due = chrono::steady_clock::now();
+
+                Request request = requests.empty() ? random_round(rng) : requests[i % requests.size()];
+                request.id = i;
+                Response response;
+                try {
+                    response = channel_request(ring, channel, request);
+                } catch (exception &e) {
+                    cerr << "client " << c << ": " << e.what() << endl;
+                    return;
+                }
+                latencies[c].push_back(elapsed_us(due));
+                statuses[c][response.status]++;
+            }
+            channel_release(ring, channel);
+        });
+    }
+    for (thread &client : threads) client.join();
+    double seconds = elapsed_us(begin) / 1e6;
+    ring_close(ring);
+
+    vector<long long> all;
+    map<int, long long> counts;
+    for (int c = 0; c < clients; c++) {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        for (auto &entry : statuses[c]) counts[entry.first] += entry.second;
+    }
+    sort(all.begin(), all.end());
+
+    auto percentile = [&all](double p) { return all.empty() ? 0LL : all[min(all.size() - 1, (size_t)(p * all.size()))]; };
+    cout << "requests: " << all.size() << " in " << seconds << " s, " << all.size() / seconds << " per second" << endl;
+    cout << "latency:  p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, p999 " << percentile(0.999) << " us, max " << (all.empty() ? 0 : all.back()) << " us" << endl;
+    cout << "statuses:";
+    for (auto &entry : counts) cout << " " << entry.first << ": " << entry.second;
+    cout << endl;
+}
+
+/********************************************************************
+PUZZLE GENERATOR
+********************************************************************/
+
+// Fresh Countdown puzzles meeting constraints on the number of solutions
+// or the fewest operations a solution needs. Selections are drawn like
+// random rounds; one set of tables then answers every target from 100 to
+// 999 at once, and a few of the targets that fit are kept, so rejection
+// costs a table lookup rather than a solve. Only a constraint on the number
+// of solutions needs the counting tables, otherwise the subset tables do.
+struct Puzzle {
+    vector<int32_t> cards;
+    int32_t target;
+    long long solutions; // -1 if not counted
+    int operations;
+};
+
+struct PuzzleOptions {
+    long long count;
+    long long solutions; // exactly, -1 for any
+    int operations; // fewest exactly, -1 for any
+    int per_selection; // most targets taken from one selection
+    int threads;
+    uint64_t seed;
+
+    PuzzleOptions() : count(1000), solutions(-1), operations(-1), per_selection(4), threads(thread::hardware_concurrency()), seed(random_device()()) {}
+};
+
+// all targets of the cards meeting the constraints
+vector<Puzzle> candidates(const vector<int32_t> &cards, const PuzzleOptions &options) {
+    vector<double> numbers(cards.begin(), cards.end());
+    vector<Puzzle> found;
+
+    if (options.solutions >= 0) {
+        CountTables tables = count_tables(numbers, RULES_COUNTDOWN);
+        for (int32_t target = 100; target <= 999; target++) {
+            int operations;
+            long long solutions = count_solutions(tables, target, operations);
+            if (solutions != options.solutions || (options.operations >= 0 && operations != options.operations)) continue;
+            found.push_back(Puzzle{cards, target, solutions, operations});
+        }
+        return found;
+    }
+
+    // the fewest operations are those of the smallest subset reaching a target
+    long long explored = 0;
+    SubsetTables tables = build_tables(numbers, explored, true, RULES_COUNTDOWN);
+    vector<int> fewest(900, -1);
+    for (unsigned mask = 1; mask < tables.values.size(); mask++) {
+        int operations = __builtin_popcount(mask) - 1;
+        auto first = lower_bound(tables.values[mask].begin(), tables.values[mask].end(), 100.);
+        auto last = upper_bound(first, tables.values[mask].end(), 999.);
+        for (; first != last; ++first) {
+            int &known = fewest[(int)*first - 100];
+            if (known < 0 || operations < known) known = operations;
+        }
+    }
+    for (int32_t target = 100; target <= 999; target++) {
+        int operations = fewest[target - 100];
+        if (operations < 0 || (options.operations >= 0 && operations != options.operations)) continue;
+        found.push_back(Puzzle{cards, target, -1, operations});
+    }
+    return found;
+}
+
+// selections drawn in a row without a puzzle before giving up
+#define PUZZLE_ATTEMPTS 1000
+
+// generates on all threads, handing every puzzle to emit under a lock;
+// throws if the constraints cannot be met or no selection meets them
+void generate(const PuzzleOptions &options, function<void(const Puzzle&)> emit) {
+    if (options.operations < -1 || options.operations >= DATABASE_CARDS || options.solutions < -1) throw GeneratorException();
+
+    atomic<long long> made(0);
+    atomic<long long> fruitless(0);
+    mutex lock;
+    vector<thread> workers;
+    for (int t = 0; t < max(options.threads, 1); t++) {
+        workers.emplace_back([&, t]() {
+            mt19937_64 rng(options.seed + t);
+            while (made < options.count && fruitless < PUZZLE_ATTEMPTS) {
+                vector<int32_t> cards = random_round(rng).numbers;
+                sort(cards.begin(), cards.end());
+                vector<Puzzle> found = candidates(cards, options);
+                shuffle(found.begin(), found.end(), rng);
+                if ((int)found.size() > options.per_selection) found.resize(options.per_selection);
+
+                lock_guard<mutex> guard(lock);
+                if (found.empty()) fruitless++;
+                else fruitless = 0;
+                for (const Puzzle &puzzle : found) {
+                    if (made >= options.count) break;
+                    made++;
+                    emit(puzzle);
+                }
+            }
+        });
+    }
+    for (thread &worker : workers) worker.join();
+    if (made < options.count) throw GeneratorException();
+}
+
+/********************************************************************
+MAIN
+********************************************************************/
+
+#define MS 1000
+#define US 1000000
+#define NS 1000000000
+
+struct Metrics {
+    Best best;
+    long long explored;
+    long long s, ms, us, ns;
+
+    Metrics(Best best, long long explored, long long time) : best(best), explored(explored) {
+        s = time / NS;
+        time -= NS * s;
+        ms = time / (NS/MS);
+        time -= NS/MS * ms;
+        us = time / (NS/US);
+        time -= NS/US * us;
+        ns = time;
+    }
+};
+
+ostream& operator<<(ostream &os, const Metrics &metrics) {
+    os << "best: " << std::setfill(' ') << std::setw(30) << metrics.best << ", explored " << std::setfill(' ') << std::setw(10) << metrics.explored << " nodes in "
+        << std::setfill('0') << std::setw(3) << metrics.s 
+        << " . " << std::setfill('0') << std::setw(3) << metrics.ms 
+        << " " << std::setfill('0') << std::setw(3) << metrics.us 
+        << " " << std::setfill('0') << std::setw(3) << metrics.ns << " seconds";
+    return os;
+}
+
+Metrics run(function<Best(long long&)> task) {
+    long long explored = 0;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    Best best = task(explored);
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+    return Metrics(best, explored, chrono::duration_cast<chrono::nanoseconds> (end - begin).count());
+}
+
+void run_test(double target, set<double> numbers) {
+    cout << "target: " << target << endl;
+    cout << "numbers: ";
+    for (double number : numbers) cout << number << " ";
+    cout << endl;
+
+    Metrics m_dfs = run([target, numbers](long long &explored){
+        return dfs(make_shared<Open>(), target, numbers, Best(), explored);
+    });
+    cout << "DFS        " << m_dfs << endl;
+
+    Metrics astar_count = run([target, numbers](long long &explored){
+        return astar(target, numbers, explored, false, false, [numbers](shared_ptr<Expr> expr){ return numbers.size() - expr->numbers().size(); });
+    });
+    cout << "SRCH CNT   " << astar_count << endl;
+
+    Metrics astar_diff = run([target, numbers](long long &explored){
+        return astar(target, numbers, explored, false, false, [target](shared_ptr<Expr> expr){ return abs(target - expr->evaluate_missing()); });
+    });
+    cout << "SRCH DIFF  " << astar_diff << endl;
+
+    Metrics astar_frac = run([target, numbers](long long &explored){
+        return astar(target, numbers, explored, false, false, [target](shared_ptr<Expr> expr){ 
+            double div = target / expr->evaluate_missing(); 
+            if (div < 1.0) div = 1. / div;
+            return div;
+        });
+    });
+    cout << "SRCH DV LG " << astar_frac << endl;
+
+    Metrics astar_div = run([target, numbers](long long &explored){
+        return astar(target, numbers, explored, false, false, [target](shared_ptr<Expr> expr){ 
+            double div = target / expr->evaluate_missing(); 
+            if (div > 1.0) div = 1. / div;
+            return div;
+        });
+    });
+    cout << "SRCH DV SM " << astar_div << endl;
+
+    vector<double> packed(numbers.begin(), numbers.end());
+
+    Metrics m_dfs_packed = run([target, packed](long long &explored){
+        return dfs_packed(target, packed, explored);
+    });
+    cout << "PACK DFS   " << m_dfs_packed << endl;
+
+    // any result within 5 ends the search
+    Metrics m_window = run([target, packed](long long &explored){
+        return dfs_packed(target, packed, explored, Scoring(5.));
+    });
+    cout << "PACK WIN 5 " << m_window << endl;
+
+    Metrics astar_packed_diff = run([target, packed](long long &explored){
+        return astar_packed(target, packed, explored, false, [target, packed](Packed expr){ return abs(target - packed_evaluate_missing(expr, packed)); });
+    });
+    cout << "PACK DIFF  " << astar_packed_diff << endl;
+
+    Metrics m_parallel = run([target, packed](long long &explored){
+        return parallel_search(target, packed, thread::hardware_concurrency(), explored);
+    });
+    cout << "RANK PAR   " << m_parallel << endl;
+
+    Metrics m_sliced = run([target, packed](long long &explored){
+        DfsTask task(target, packed);
+        while (!task.step(1000)) {}
+        explored += task.explored;
+        return task.result();
+    });
+    cout << "DFS SLICED " << m_sliced << endl;
+
+    Metrics m_dp = run([target, packed](long long &explored){
+        return dp_solve(target, packed, explored);
+    });
+    cout << "DP         " << m_dp << endl;
+
+    Metrics m_mitm = run([target, packed](long long &explored){
+        SubsetTables tables = build_tables(packed, explored, false);
+        shared_ptr<Expr> proof = solve_mitm(tables, target);
+        return proof->is_open() ? Best() : Best(proof);
+    });
+    cout << "MITM PROOF " << m_mitm << endl;
+
+    // numbers revealed one at a time, timing only the last one
+    shared_ptr<SolverSession> session = make_shared<SolverSession>();
+    for (size_t i = 0; i + 1 < packed.size(); i++) session->add(packed[i]);
+    Metrics m_session = run([target, packed, session](long long &explored){
+        explored += session->add(packed.back());
+        return session->query(target);
+    });
+    cout << "SESSION    " << m_session << endl;
+
+    mt19937_64 rng(0);
+    cout << "DENSITY    within  0: " << estimate_density(target, packed, 0., 100000, rng) << endl;
+    cout << "DENSITY    within 10: " << estimate_density(target, packed, 10., 100000, rng) << endl;
+}
+
+void run_tests() {
+    // 10 / x lands in [-0.5, 1.5] for x >= 6.67 or x <= -20, across the pole
+    map<double, shared_ptr<Expr>> values = {{0.1, make_shared<Lit>(0.1)}, {8., make_shared<Lit>(8.)}};
+    shared_ptr<Expr> pole = fill_window(make_shared<Op<Div>>(make_shared<Lit>(10.), make_shared<Open>()), 0.5, values, Scoring(1.));
+    cout << "WINDOW POLE " << (pole ? pole->to_string() + " = " + to_string(pole->evaluate()) : string("missed")) << endl << endl;
+
+    run_test(25.0, {1., 2., 3., 4.});
+    run_test(525.0, {5., 7., 10., 13});
+    run_test(25.0, {1., 2., 3., 4., 5.});
+    run_test(147.0, {4., 5., 8., 20., 27.});
+    run_test(432.0, {3., 5., 7., 11., 13.});
+    run_test(737.0, {1., 4., 5., 6., 7., 25.});
+    run_test(728.0, {6., 10., 25., 75., 5., 50.});
+}
+
+int query(const char *name, const vector<string> &args) {
+    Request request;
+    size_t i = 0;
+    for (; i < args.size() && args[i].compare(0, 2, "--") == 0; i++) {
+        if (args[i] == "--countdown") request.rules = RULES_COUNTDOWN;
+        else if (args[i] == "--batch") request.priority = PRIORITY_BATCH;
+        else if (args[i] == "--dfs") request.engine = ENGINE_DFS;
+        else if (args[i] == "--deadline" && i + 1 < args.size()) request.deadline = stoul(args[++i]);
+        else if (args[i] == "--session" && i + 1 < args.size()) request.session = stoull(args[++i]);
+    }
+    if (i >= args.size()) return 1;
+    request.target = stoi(args[i++]);
+    for (; i < args.size(); i++) request.numbers.push_back(stoi(args[i]));
+
+    Ring *ring = ring_open(name);
+    int channel = channel_acquire(ring);
+    if (channel < 0) {
+        cerr << "no free channel" << endl;
+        return 1;
+    }
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    Response response = channel_request(ring, channel, request);
+    long long round_trip = elapsed_us(begin);
+    channel_release(ring, channel);
+    ring_close(ring);
+
+    vector<double> numbers(request.numbers.begin(), request.numbers.end());
+    if (response.status == STATUS_INVALID) cout << "invalid request" << endl;
+    else if (response.status == STATUS_SHED) cout << "request shed" << endl;
+    else if (response.status == STATUS_OVER_BUDGET) cout << "request over budget" << endl;
+    else if (response.status == STATUS_EXPIRED) cout << "request expired" << endl;
+    else if (response.expr == PACKED_OPEN) cout << "nothing found, solved in " << response.elapsed << " us" << endl;
+    else {
+        cout << unpack(response.expr, numbers)->to_string() << " = " << response.value << (response.status == STATUS_PARTIAL ? " so far" : "");
+        if (request.rules == RULES_COUNTDOWN) cout << ", " << COUNTDOWN_SCORING.score(response.value, request.target) << " points";
+        cout << ", solved in " << response.elapsed << " us, round trip " << round_trip << " us" << endl;
+    }
+    return response.status;
+}
+
+// tables of the most frequent number sets in a query log
+void make_snapshot(const string &path, const string &log, size_t count) {
+    vector<shared_ptr<const SubsetTables>> tables;
+    for (const TableKey &key : popular_keys(log, count)) {
+        long long explored = 0;
+        tables.push_back(make_shared<SubsetTables>(build_tables(vector<double>(key.second.begin(), key.second.end()), explored, true, key.first)));
+    }
+    write_snapshot(path, tables);
+
+    shared_ptr<Snapshot> snapshot = open_snapshot(path);
+    cout << snapshot->views.size() << " tables, " << snapshot->size << " bytes" << endl;
+}
+
+// selections of the database reaching a target, from its reverse index
+void find_selections(const string &database_path, const string &index_path, const vector<string> &args) {
+    int min_operations = 0, max_operations = DATABASE_CARDS - 1;
+    uint64_t min_solutions = 0, max_solutions = UINT64_MAX;
+    size_t limit = 20, i = 0;
+    for (; i + 1 < args.size() && args[i].compare(0, 2, "--") == 0; i += 2) {
+        if (args[i] == "--min-operations") min_operations = stoi(args[i + 1]);
+        else if (args[i] == "--max-operations") max_operations = stoi(args[i + 1]);
+        else if (args[i] == "--min-solutions") min_solutions = stoull(args[i + 1]);
+        else if (args[i] == "--max-solutions") max_solutions = stoull(args[i + 1]);
+        else if (args[i] == "--limit") limit = stoul(args[i + 1]);
+    }
+    if (i >= args.size()) return;
+    int target = stoi(args[i]);
+
+    shared_ptr<Database> database = open_database(database_path);
+    shared_ptr<ReverseIndex> index = open_index(index_path);
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    vector<Posting> found = index_query(*index, target, min_operations, max_operations, min_solutions, max_solutions);
+    long long elapsed = elapsed_us(begin);
+
+    for (size_t j = 0; j < found.size() && j < limit; j++) {
+        for (int32_t card : database->cards(found[j].id)) cout << card << " ";
+        cout << "- " << found[j].operations << " operations, " << found[j].solutions << " solutions" << endl;
+    }
+    cout << found.size() << " selections in " << elapsed << " us" << endl;
+}
+
+// set questions over the reachability of every selection: the targets all
+// or some make, the hardest ones, and the selections making all the targets
+void reach_report(const string &database_path, const vector<string> &args) {
+    string index_path;
+    int cards = 0;
+    size_t limit = 20, i = 0;
+    for (; i + 1 < args.size() && args[i].compare(0, 2, "--") == 0; i += 2) {
+        if (args[i] == "--index") index_path = args[i + 1];
+        else if (args[i] == "--cards") cards = stoi(args[i + 1]);
+        else if (args[i] == "--limit") limit = stoul(args[i + 1]);
+    }
+    uint64_t targets[REACH_WORDS] = {};
+    for (; i < args.size(); i++) {
+        int target = stoi(args[i]);
+        if (target >= REACH_LOW && target <= REACH_HIGH) reach_set(targets, target);
+    }
+
+    shared_ptr<Database> database = open_database(database_path);
+    ReachMatrix matrix = index_path.empty() ? reach_matrix(*database) : reach_matrix(*open_index(index_path), database->count);
+    if (cards < 0 || cards > matrix.cards) cards = 0;
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    uint64_t every[REACH_WORDS], some[REACH_WORDS];
+    reach_all(matrix, cards, every);
+    reach_any(matrix, cards, some);
+    vector<uint32_t> counts = reach_counts(matrix, cards);
+    vector<uint32_t> covering = reach_covering(matrix, cards, targets);
+    long long elapsed = elapsed_us(begin);
+
+    cout << matrix.selections << " selections, " << reach_count(every) << " targets made by all, " << reach_count(some) << " by some" << endl;
+    vector<int> hardest;
+    for (int target = REACH_LOW; target <= REACH_HIGH; target++) hardest.push_back(target);
+    stable_sort(hardest.begin(), hardest.end(), [&](int lhs, int rhs) { return counts[lhs - REACH_LOW] < counts[rhs - REACH_LOW]; });
+    cout << "hardest:";
+    for (size_t j = 0; j < 10; j++) cout << " " << hardest[j] << " (" << counts[hardest[j] - REACH_LOW] << ")";
+    cout << endl;
+
+    if (reach_count(targets) > 0) {
+        for (size_t j = 0; j < covering.size() && j < limit; j++) {
+            for (int32_t card : database->cards(covering[j])) cout << card << " ";
+            cout << endl;
+        }
+        cout << covering.size() << " selections make every target" << endl;
+    }
+    cout << "queries in " << elapsed << " us" << endl;
+}
+
+// the number of expressions of every value of the numbers, summed up in
+// buckets of powers of two
+void count_report(const vector<string> &args) {
+    int rules = RULES_FREE;
+    bool values = false;
+    vector<double> numbers;
+    for (const string &arg : args) {
+        if (arg == "--countdown") rules = RULES_COUNTDOWN;
+        else if (arg == "--values") values = true;
+        else numbers.push_back(stod(arg));
+    }
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    vector<pair<double, uint64_t>> counts = solution_counts(count_tables(numbers, rules));
+    map<uint64_t, size_t> histogram = solution_histogram(counts);
+    long long elapsed = elapsed_us(begin);
+
+    if (values) {
+        for (const pair<double, uint64_t> &value : counts) cout << value.first << " " << value.second << endl;
+    }
+
+    uint64_t total = 0;
+    for (const pair<double, uint64_t> &value : counts) total += value.second;
+    cout << counts.size() << " values, " << total << " expressions in " << elapsed << " us" << endl;
+
+    auto it = histogram.begin();
+    for (uint64_t low = 1; it != histogram.end(); low *= 2) {
+        size_t bucket = 0;
+        for (; it != histogram.end() && it->first < 2 * low; ++it) bucket += it->second;
+        if (bucket) cout << low << ".." << 2 * low - 1 << " solutions: " << bucket << " values" << endl;
+    }
+}
+
+// the solutions of a target as a forest: its size, and optionally the graph,
+// the first solutions or a sample of them
+void forest_report(const vector<string> &args) {
+    int rules = RULES_FREE;
+    bool graph = false;
+    size_t list = 0, sample = 0, i = 0;
+    for (; i < args.size() && args[i].compare(0, 2, "--") == 0; i++) {
+        if (args[i] == "--countdown") rules = RULES_COUNTDOWN;
+        else if (args[i] == "--graph") graph = true;
+        else if (args[i] == "--list" && i + 1 < args.size()) list = stoul(args[++i]);
+        else if (args[i] == "--sample" && i + 1 < args.size()) sample = stoul(args[++i]);
+    }
+    if (i + 1 >= args.size()) return;
+    double target = stod(args[i]);
+    vector<double> numbers;
+    for (i++; i < args.size(); i++) numbers.push_back(stod(args[i]));
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    SolutionForest forest = solution_forest(count_tables(numbers, rules), target);
+    long long elapsed = elapsed_us(begin);
+
+    if (graph) write_forest(cout, forest);
+    for (uint64_t k = 0; k < list && k < forest.count(); k++) cout << unpack(forest_solution(forest, k), forest.numbers)->to_string() << endl;
+    mt19937_64 rng(random_device{}());
+    for (size_t k = 0; k < sample && forest.count() > 0; k++) cout << unpack(forest_sample(forest, rng), forest.numbers)->to_string() << endl;
+    cout << forest.count() << " solutions in " << forest.nodes.size() << " nodes and " << forest.edges.size() << " edges, " << elapsed << " us" << endl;
+}
+
+const char *usage =
+    "usage: calcnum                                 run the benchmarks\n"
+    "       calcnum serve NAME [WORKERS] [--metrics-file PATH] [--metrics-socket PATH]\n"
+    "                         [--interactive-queue N] [--batch-queue N] [--cpu-limit MS] [--memory-limit MB]\n"
+    "                         [--cached-tables N] [--slice N] [--session-ttl S] [--session-memory MB]\n"
+    "                         [--query-log PATH] [--warm PATH] [--warm-count N] [--snapshot PATH]\n"
+    "                         [--shared-cache NAME] [--shared-memory MB] [--result-store PATH]\n"
+    "                         [--database PATH]\n"
+    "       calcnum snapshot PATH LOG [COUNT]\n"
+    "       calcnum database PATH [--threads N] [--index PATH]\n"
+    "       calcnum generate [--count N] [--solutions K] [--operations S] [--per-selection N]\n"
+    "                         [--threads N] [--seed N]\n"
+    "       calcnum atlas PATH [--threads N] [--chunk N] [--dfs-limit N]\n"
+    "       calcnum selections DATABASE INDEX [--min-operations N] [--max-operations N]\n"
+    "                         [--min-solutions N] [--max-solutions N] [--limit N] TARGET\n"
+    "       calcnum reach DATABASE [--index PATH] [--cards N] [--limit N] [TARGET...]\n"
+    "       calcnum count [--countdown] [--values] NUMBER...\n"
+    "       calcnum forest [--countdown] [--graph] [--list N] [--sample N] TARGET NUMBER...\n"
+    "       calcnum load NAME [--log PATH] [--rate QPS] [--concurrency N] [--duration S]\n"
+    "       calcnum query NAME [--countdown] [--batch] [--dfs] [--deadline US] [--session ID] TARGET NUMBER...\n";
+
+// runs one command line, exceptions are left to main
+int command(const vector<string> &args) {
+    if (args.empty()) {
+        run_tests();
+        return 0;
+    } else if (args[0] == "serve" && args.size() >= 2) {
+        ServerOptions options;
+        options.name = args[1];
+        for (size_t i = 2; i < args.size(); i++) {
+            if (args[i] == "--metrics-file" && i + 1 < args.size()) options.metrics_file = args[++i];
+            else if (args[i] == "--metrics-socket" && i + 1 < args.size()) options.metrics_socket = args[++i];
+            else if (args[i] == "--interactive-queue" && i + 1 < args.size()) options.interactive_queue = stoul(args[++i]);
+            else if (args[i] == "--batch-queue" && i + 1 < args.size()) options.batch_queue = stoul(args[++i]);
+            else if (args[i] == "--cpu-limit" && i + 1 < args.size()) options.cpu_limit = stoll(args[++i]);
+            else if (args[i] == "--memory-limit" && i + 1 < args.size()) options.memory_limit = stoul(args[++i]);
+            else if (args[i] == "--cached-tables" && i + 1 < args.size()) options.cached_tables = stoul(args[++i]);
+            else if (args[i] == "--slice" && i + 1 < args.size()) options.slice = stoll(args[++i]);
+            else if (args[i] == "--session-ttl" && i + 1 < args.size()) options.session_ttl = stoll(args[++i]);
+            else if (args[i] == "--session-memory" && i + 1 < args.size()) options.session_memory = stoul(args[++i]);
+            else if (args[i] == "--query-log" && i + 1 < args.size()) options.query_log = args[++i];
+            else if (args[i] == "--warm" && i + 1 < args.size()) options.warm_log = args[++i];
+            else if (args[i] == "--warm-count" && i + 1 < args.size()) options.warm_count = stoul(args[++i]);
+            else if (args[i] == "--snapshot" && i + 1 < args.size()) options.snapshot = args[++i];
+            else if (args[i] == "--shared-cache" && i + 1 < args.size()) options.shared_cache = args[++i];
+            else if (args[i] == "--shared-memory" && i + 1 < args.size()) options.shared_memory = stoul(args[++i]);
+            else if (args[i] == "--result-store" && i + 1 < args.size()) options.result_store = args[++i];
+            else if (args[i] == "--database" && i + 1 < args.size()) options.database = args[++i];
+            else if (args[i].compare(0, 2, "--") != 0) options.workers = stoi(args[i]);
+            else {
+                cerr << "unknown option " << args[i] << endl << usage;
+                return 1;
+            }
+        }
+        serve(options);
+        return 0;
+    } else if (args[0] == "load" && args.size() >= 2) {
+        LoadOptions options;
+        options.name = args[1];
+        for (size_t i = 2; i + 1 < args.size(); i += 2) {
+            if (args[i] == "--log") options.log = args[i + 1];
+            else if (args[i] == "--rate") options.rate = stod(args[i + 1]);
+            else if (args[i] == "--concurrency") options.concurrency = stoi(args[i + 1]);
+            else if (args[i] == "--duration") options.duration = stod(args[i + 1]);
+        }
+        load(options);
+        return 0;
+    } else if (args[0] == "database" && args.size() >= 2) {
+        int threads = thread::hardware_concurrency();
+        string index;
+        for (size_t i = 2; i + 1 < args.size(); i += 2) {
+            if (args[i] == "--threads") threads = stoi(args[i + 1]);
+            else if (args[i] == "--index") index = args[i + 1];
+        }
+        vector<SelectionStats> stats;
+        write_database(args[1], selections(DECK, DATABASE_CARDS), threads, index.empty() ? nullptr : &stats);
+        if (!index.empty()) write_index(index, stats);
+        return 0;
+    } else if (args[0] == "atlas" && args.size() >= 2) {
+        AtlasOptions options;
+        options.path = args[1];
+        for (size_t i = 2; i + 1 < args.size(); i += 2) {
+            if (args[i] == "--threads") options.threads = stoi(args[i + 1]);
+            else if (args[i] == "--chunk") options.chunk = stoul(args[i + 1]);
+            else if (args[i] == "--dfs-limit") options.dfs_limit = stoll(args[i + 1]);
+        }
+        atlas(options);
+        return 0;
+    } else if (args[0] == "generate") {
+        PuzzleOptions options;
+        for (size_t i = 1; i + 1 < args.size(); i += 2) {
+            if (args[i] == "--count") options.count = stoll(args[i + 1]);
+            else if (args[i] == "--solutions") options.solutions = stoll(args[i + 1]);
+            else if (args[i] == "--operations") options.operations = stoi(args[i + 1]);
+            else if (args[i] == "--per-selection") options.per_selection = stoi(args[i + 1]);
+            else if (args[i] == "--threads") options.threads = stoi(args[i + 1]);
+            else if (args[i] == "--seed") options.seed = stoull(args[i + 1]);
+        }
+
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        generate(options, [](const Puzzle &puzzle) {
+            for (int32_t card : puzzle.cards) cout << card << " ";
+            cout << "-> " << puzzle.target << " (" << puzzle.operations << " operations";
+            if (puzzle.solutions >= 0) cout << ", " << puzzle.solutions << " solutions";
+            cout << ")\n";
+        });
+        cerr << options.count * 1e6 / elapsed_us(begin) << " puzzles per second" << endl;
+        return 0;
+    } else if (args[0] == "selections" && args.size() >= 4) {
+        find_selections(args[1], args[2], vector<string>(args.begin() + 3, args.end()));
+        return 0;
+    } else if (args[0] == "reach" && args.size() >= 2) {
+        reach_report(args[1], vector<string>(args.begin() + 2, args.end()));
+        return 0;
+    } else if (args[0] == "count" && args.size() >= 2) {
+        count_report(vector<string>(args.begin() + 1, args.end()));
+        return 0;
+    } else if (args[0] == "forest" && args.size() >= 3) {
+        forest_report(vector<string>(args.begin() + 1, args.end()));
+        return 0;
+    } else if (args[0] == "snapshot" && args.size() >= 3) {
+        make_snapshot(args[1], args[2], args.size() >= 4 ? stoul(args[3]) : 64);
+        return 0;
+    } else if (args[0] == "query" && args.size() >= 3) {
+        return query(args[1].c_str(), vector<string>(args.begin() + 2, args.end()));
+    }
+
+    cerr << usage;
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    try {
+        return command(vector<string>(argv + 1, argv + argc));
+    } catch (exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}